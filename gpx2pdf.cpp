@@ -5,23 +5,31 @@
 
   @section DESCRIPTION
   A class that reads waypoints from a GPX file and places them on a map from a GeoPDF file
-  The status is outputed to std::cout as the data is processed
+  The status is outputed to std::cout (or the stream set with setOutputStream()) as the data is processed
  */
 
 #include "gpx2pdf.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
 
 #include <QFile>
+#include <QFileInfo>
 #include <QtXml/QDomDocument>
 
 #include <podofo/podofo.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
 #include <gdal.h>
 #include <gdal_priv.h>
 #include <ogr_core.h>
 #include <ogr_spatialref.h>
 
 #define GPX2PDF_VERSION  "1.0"
+#define GPX2PDF_MAX_AGGREGATION_CELLS  250000
 
 gpx2pdf::gpx2pdf(std::string gpxFile, std::string pdfFileIn, std::string pdfFileOut) {
     this->gpxFile = gpxFile;
@@ -32,11 +40,19 @@ gpx2pdf::gpx2pdf(std::string gpxFile, std::string pdfFileIn, std::string pdfFile
     this->useGsakSmartName = true;
     this->maxNameLength = 10;
     this->nameFontSize = 8.0;
+    this->lowMemory = false;
+    this->aggregationMode = gpx2pdf::AGGREGATE_NONE;
+    this->aggregationThreshold = 1000;
+    this->aggregationCellSize = 30.0;
+    this->out = &std::cout;
+    this->waypoints = std::make_shared<std::vector<waypoint>>();
     this->pdfSRS = nullptr;
     this->WGS84.SetWellKnownGeogCS("WGS84");
     this->coordTF = nullptr;
     this->xPixels = 0;
     this->yPixels = 0;
+    this->dpi = 0.0;
+    this->pageCount = 0;
 }
 
 gpx2pdf::~gpx2pdf() {
@@ -48,7 +64,7 @@ gpx2pdf::~gpx2pdf() {
 
 gpx2pdf::g2pErr gpx2pdf::doConversion() {
     gpx2pdf::g2pErr result = gpx2pdf::SUCCESS;
-    std::cout << "gpx2pdf version " GPX2PDF_VERSION "\n";
+    *this->out << "gpx2pdf version " GPX2PDF_VERSION "\n";
 
     result = this->loadGpx();
     if (result != gpx2pdf::SUCCESS)
@@ -72,16 +88,17 @@ gpx2pdf::g2pErr gpx2pdf::doConversion(std::string gpxFile, std::string pdfFileIn
 
 gpx2pdf::g2pErr gpx2pdf::loadGpx() {
     QDomDocument xmlDoc;
-    std::cout << "Reading GPX file: " << this->gpxFile << "\n";
+    std::shared_ptr<std::vector<waypoint>> loadedWaypoints = std::make_shared<std::vector<waypoint>>();
+    *this->out << "Reading GPX file: " << this->gpxFile << "\n";
 
     QFile file(QString::fromStdString(this->gpxFile));
     if (!file.open(QIODevice::ReadOnly)) {
-        std::cout << "Unable to open GPX file for reading: " << this->gpxFile << "\n";
+        *this->out << "Unable to open GPX file for reading: " << this->gpxFile << "\n";
         return gpx2pdf::FILE_ERROR;
     }
     if (!xmlDoc.setContent(&file)) {
         file.close();
-        std::cout << "Unable to parse GPX file - GPX file is not valid\n";
+        *this->out << "Unable to parse GPX file - GPX file is not valid\n";
         return gpx2pdf::PARSE_ERROR;
     }
     file.close();
@@ -117,25 +134,45 @@ gpx2pdf::g2pErr gpx2pdf::loadGpx() {
         if (this->maxNameLength >= 0)
             nameStr = nameStr.left(this->maxNameLength);
 
-        this->waypoints.push_back({lat, lon, nameStr.toStdString()});
+        loadedWaypoints->push_back({lat, lon, nameStr.toStdString()});
     }
+    this->waypoints = loadedWaypoints;
 
-    std::cout << this->waypoints.size() << " waypoint(s) read\n";
-    if (this->waypoints.size() < 1)
+    *this->out << this->waypoints->size() << " waypoint(s) read\n";
+    if (this->waypoints->size() < 1)
         return gpx2pdf::EMPTY_DATA;
 
     return gpx2pdf::SUCCESS;
 }
 
+void gpx2pdf::initPdfLibrary() {
+    // These are global settings in PoDoFo, so only set them once in case conversions run on several threads
+    static std::once_flag initFlag;
+    std::call_once(initFlag, []() {
+        PoDoFo::PdfError::EnableDebug(false);
+        PoDoFo::PdfError::EnableLogging(false);
+    });
+}
+
 gpx2pdf::g2pErr gpx2pdf::savePdf() {
-    PoDoFo::PdfError::EnableDebug(false);
-    PoDoFo::PdfError::EnableLogging(false);
+    gpx2pdf::initPdfLibrary();
+
+    // The input file is still being read while the output is written (and in low memory mode it is copied into the output)
+    QFileInfo inputInfo(QString::fromStdString(this->pdfFileIn));
+    QFileInfo outputInfo(QString::fromStdString(this->pdfFileOut));
+    QString inputPath = inputInfo.exists() ? inputInfo.canonicalFilePath() : inputInfo.absoluteFilePath();
+    QString outputPath = outputInfo.exists() ? outputInfo.canonicalFilePath() : outputInfo.absoluteFilePath();
+    if (inputPath == outputPath) {
+        *this->out << "The output file can not be the same as the input PDF file\n";
+        return gpx2pdf::FILE_ERROR;
+    }
 
     PoDoFo::PdfMemDocument* docPodofo = new PoDoFo::PdfMemDocument();
     PoDoFo::PdfPage* pagePodofo = nullptr;
 
     try {
-        docPodofo->Load(this->pdfFileIn.c_str());
+        // Objects are parsed on demand, loading for update also keeps the file name so WriteUpdate() can copy it through
+        docPodofo->Load(this->pdfFileIn.c_str(), this->lowMemory);
     } catch(PoDoFo::PdfError& pdfError) {
         if (pdfError.GetError() == PoDoFo::ePdfError_InvalidPassword) {
             if (this->pdfPassword.size()) {
@@ -143,36 +180,36 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
                     docPodofo->SetPassword(this->pdfPassword);
                 } catch(PoDoFo::PdfError& pdfError2) {
                     if (pdfError2.GetError() == PoDoFo::ePdfError_InvalidPassword) {
-                        std::cout << "Invalid password\n";
+                        *this->out << "Invalid password\n";
                     } else {
-                        std::cout << "Invalid PDF: " << pdfError2.what() << "\n";
+                        *this->out << "Invalid PDF: " << pdfError2.what() << "\n";
                     }
                     delete docPodofo;
                     return gpx2pdf::ERROR;
                 } catch(...) {
-                    std::cout << "Invalid PDF\n";
+                    *this->out << "Invalid PDF\n";
                     delete docPodofo;
                     return gpx2pdf::ERROR;
                 }
             } else {
-                std::cout << "PDF file is encrypted\n";
+                *this->out << "PDF file is encrypted\n";
                 delete docPodofo;
                 return gpx2pdf::FILE_ERROR;
             }
         } else {
-            std::cout << "PDF Error: " << pdfError.what() << "\n";
+            *this->out << "PDF Error: " << pdfError.what() << "\n";
             delete docPodofo;
             return gpx2pdf::ERROR;
         }
     } catch(...) {
-        std::cout << "Invalid PDF\n";
+        *this->out << "Invalid PDF\n";
         delete docPodofo;
         return gpx2pdf::ERROR;
     }
 
     int nPages = docPodofo->GetPageCount();
     if (this->pageNumber < 1 || this->pageNumber > nPages) {
-        std::cout << "Invalid page number: " << this->pageNumber << " (PDF file has " << nPages << " pages)\n";
+        *this->out << "Invalid page number: " << this->pageNumber << " (PDF file has " << nPages << " pages)\n";
         delete docPodofo;
         return gpx2pdf::INVALID_ARGUMENT;
     }
@@ -180,17 +217,17 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
     try {
         pagePodofo = docPodofo->GetPage(this->pageNumber - 1);
     } catch(PoDoFo::PdfError& pdfError) {
-        std::cout << "PDF Error: " << pdfError.what() << "\n";
+        *this->out << "PDF Error: " << pdfError.what() << "\n";
         delete docPodofo;
         return gpx2pdf::ERROR;
     } catch(...) {
-        std::cout << "Invalid PDF\n";
+        *this->out << "Invalid PDF\n";
         delete docPodofo;
         return gpx2pdf::ERROR;
     }
 
     if (!pagePodofo) {
-        std::cout << "Invalid PDF Page\n";
+        *this->out << "Invalid PDF Page\n";
         delete docPodofo;
         return gpx2pdf::INVALID_ARGUMENT;
     }
@@ -204,7 +241,7 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
         pFont = docPodofo->CreateFont("Helvetica");
 
         if (!pFont) {
-            std::cout << "Error creating font\n";
+            *this->out << "Error creating font\n";
             delete docPodofo;
             return gpx2pdf::ERROR;
         }
@@ -214,7 +251,7 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
 
         const PoDoFo::PdfFontMetrics* fontMetrics = pFont->GetFontMetrics();
         if (!fontMetrics) {
-            std::cout << "Error creating font metrics\n";
+            *this->out << "Error creating font metrics\n";
             delete docPodofo;
             return gpx2pdf::ERROR;
         }
@@ -228,12 +265,18 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
         double pageHeight = pagePodofo->GetPageSize().GetHeight();
         double pageWidth = pagePodofo->GetPageSize().GetWidth();
 
-        int waypointCount = 0;
+        // Convert all the waypoints to PDF units first, so the number on the page is known before drawing
+        struct pagePoint {
+            double x;
+            double y;
+            unsigned int index;
+        };
+        std::vector<pagePoint> pagePoints;
         bool convertError = false;
-        for (unsigned int i = 0; i < this->waypoints.size(); i++) {
+        for (unsigned int i = 0; i < this->waypoints->size(); i++) {
 
             double x = 0, y = 0;
-            if (convertCoordsToPixels(this->waypoints.at(i).lat, this->waypoints.at(i).lon, &x, &y) == g2pErr::SUCCESS) {
+            if (convertCoordsToPixels(this->waypoints->at(i).lat, this->waypoints->at(i).lon, &x, &y) == g2pErr::SUCCESS) {
 
                 // Convert the pixels to PDF units
                 // This should be done using the DPI value but GDAL doesn't expose that value in their API
@@ -242,68 +285,174 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
                 y = y * pageHeight / static_cast<double>(this->yPixels);
 
                 // if the waypoint is on the PDF page
-                if (x >= 0 && x <= pageWidth && y >= 0 && y <= pageHeight) {
+                if (x >= 0 && x <= pageWidth && y >= 0 && y <= pageHeight)
+                    pagePoints.push_back({x, y, i});
+            } else {
+                convertError = true;
+            }
 
-                    // get width of the name rectangle
-                    double textWidth = fontMetrics->StringWidth(this->waypoints.at(i).name.c_str());
+        }
 
-                    // draw yellow rectangle
-                    painter.SetColor(PoDoFo::PdfColor(1.0, 1.0, 0.0));
-                    painter.Rectangle(x - textWidth / 2 - 2, pageHeight - y + 6, textWidth + 4, this->nameFontSize + 3);
-                    painter.FillAndStroke();
+        int waypointCount = static_cast<int>(pagePoints.size());
+        if (this->aggregationMode != gpx2pdf::AGGREGATE_NONE && waypointCount > this->aggregationThreshold) {
 
-                    // draw line below rectangle
-                    painter.DrawLine(x, pageHeight - y + 6, x, pageHeight - y);
+            // Bin the waypoints into a grid of cells in one pass
+            // The number of things drawn then depends on the page size and not the number of waypoints
+            double cellSize = std::max(1.0, this->aggregationCellSize);
 
-                    // draw circle on waypoint
-                    painter.SetColor(PoDoFo::PdfColor(1.0, 1.0, 1.0));
-                    painter.Circle(x, pageHeight - y, 3);
-                    painter.FillAndStroke();
+            // Limit the size of the grid, small cells on a large page would need millions of them
+            if (pageWidth * pageHeight / (cellSize * cellSize) > GPX2PDF_MAX_AGGREGATION_CELLS) {
+                cellSize = std::sqrt(pageWidth * pageHeight / GPX2PDF_MAX_AGGREGATION_CELLS);
+                *this->out << "Aggregation cell size is too small for this page, using " << cellSize << " instead\n";
+            }
 
-                    // draw cross in middle of the circle
-                    painter.DrawLine(x, pageHeight - y + 2, x, pageHeight - y - 2);
-                    painter.DrawLine(x + 2, pageHeight - y, x - 2, pageHeight - y);
+            int columns = std::max(1, static_cast<int>(std::ceil(pageWidth / cellSize)));
+            int rows = std::max(1, static_cast<int>(std::ceil(pageHeight / cellSize)));
+
+            struct cell {
+                int count;
+                double sumX;
+                double sumY;
+            };
+            std::vector<cell> cells(static_cast<size_t>(columns) * rows, {0, 0.0, 0.0});
+            int maxCount = 0;
+            for (unsigned int i = 0; i < pagePoints.size(); i++) {
+                int column = std::min(columns - 1, static_cast<int>(pagePoints.at(i).x / cellSize));
+                int row = std::min(rows - 1, static_cast<int>(pagePoints.at(i).y / cellSize));
+                cell &binCell = cells.at(static_cast<size_t>(row) * columns + column);
+                binCell.count++;
+                binCell.sumX += pagePoints.at(i).x;
+                binCell.sumY += pagePoints.at(i).y;
+                maxCount = std::max(maxCount, binCell.count);
+            }
 
-                    // draw the name within the rectangle
-                    painter.SetColor(PoDoFo::PdfColor(0.0, 0.0, 0.0));
-                    painter.DrawMultiLineText(x - textWidth / 2 - 2, pageHeight - y + 6, textWidth + 4, this->nameFontSize + 2, PoDoFo::PdfString(this->waypoints.at(i).name), PoDoFo::ePdfAlignment_Center, PoDoFo::ePdfVerticalAlignment_Center);
+            int cellCount = 0;
+            if (this->aggregationMode == gpx2pdf::AGGREGATE_HEATMAP) {
+
+                // draw the cells partly transparent so the map can still be seen under them
+                PoDoFo::PdfExtGState transparency(docPodofo);
+                transparency.SetFillOpacity(0.6f);
+                painter.Save();
+                painter.SetExtGState(&transparency);
 
-                    waypointCount++;
+                for (int row = 0; row < rows; row++) {
+                    for (int column = 0; column < columns; column++) {
+                        const cell &binCell = cells.at(static_cast<size_t>(row) * columns + column);
+                        if (binCell.count <= 0)
+                            continue;
+
+                        // colour goes from yellow for one waypoint to red for the busiest cell, on a log scale
+                        double level = maxCount > 1 ? std::log(static_cast<double>(binCell.count)) / std::log(static_cast<double>(maxCount)) : 1.0;
+                        painter.SetColor(PoDoFo::PdfColor(1.0, 1.0 - level, 0.0));
+                        painter.Rectangle(column * cellSize, pageHeight - (row + 1) * cellSize, cellSize, cellSize);
+                        painter.Fill();
+
+                        cellCount++;
+                    }
                 }
+
+                painter.Restore();
+                *this->out << waypointCount << " waypoint(s) added to PDF file as " << cellCount << " heatmap cell(s)\n";
+
             } else {
-                convertError = true;
+
+                for (unsigned int i = 0; i < cells.size(); i++) {
+                    const cell &binCell = cells.at(i);
+                    if (binCell.count <= 0)
+                        continue;
+
+                    // draw the cluster at the average position of its waypoints
+                    double x = binCell.sumX / binCell.count;
+                    double y = binCell.sumY / binCell.count;
+                    std::string label = std::to_string(binCell.count);
+                    double textWidth = fontMetrics->StringWidth(label.c_str());
+                    double radius = std::max(textWidth, this->nameFontSize) / 2 + 3;
+
+                    // draw yellow circle
+                    painter.SetColor(PoDoFo::PdfColor(1.0, 1.0, 0.0));
+                    painter.Circle(x, pageHeight - y, radius);
+                    painter.FillAndStroke();
+
+                    // draw the number of waypoints within the circle
+                    painter.SetColor(PoDoFo::PdfColor(0.0, 0.0, 0.0));
+                    painter.DrawMultiLineText(x - radius, pageHeight - y - radius, radius * 2, radius * 2, PoDoFo::PdfString(label), PoDoFo::ePdfAlignment_Center, PoDoFo::ePdfVerticalAlignment_Center);
+
+                    cellCount++;
+                }
+
+                *this->out << waypointCount << " waypoint(s) added to PDF file as " << cellCount << " cluster(s)\n";
             }
 
-        }
+        } else {
+
+            for (unsigned int i = 0; i < pagePoints.size(); i++) {
+                double x = pagePoints.at(i).x;
+                double y = pagePoints.at(i).y;
+                const std::string &name = this->waypoints->at(pagePoints.at(i).index).name;
+
+                // get width of the name rectangle
+                double textWidth = fontMetrics->StringWidth(name.c_str());
+
+                // draw yellow rectangle
+                painter.SetColor(PoDoFo::PdfColor(1.0, 1.0, 0.0));
+                painter.Rectangle(x - textWidth / 2 - 2, pageHeight - y + 6, textWidth + 4, this->nameFontSize + 3);
+                painter.FillAndStroke();
+
+                // draw line below rectangle
+                painter.DrawLine(x, pageHeight - y + 6, x, pageHeight - y);
 
-        std::cout << waypointCount << " waypoint(s) added to PDF file\n";
+                // draw circle on waypoint
+                painter.SetColor(PoDoFo::PdfColor(1.0, 1.0, 1.0));
+                painter.Circle(x, pageHeight - y, 3);
+                painter.FillAndStroke();
+
+                // draw cross in middle of the circle
+                painter.DrawLine(x, pageHeight - y + 2, x, pageHeight - y - 2);
+                painter.DrawLine(x + 2, pageHeight - y, x - 2, pageHeight - y);
+
+                // draw the name within the rectangle
+                painter.SetColor(PoDoFo::PdfColor(0.0, 0.0, 0.0));
+                painter.DrawMultiLineText(x - textWidth / 2 - 2, pageHeight - y + 6, textWidth + 4, this->nameFontSize + 2, PoDoFo::PdfString(name), PoDoFo::ePdfAlignment_Center, PoDoFo::ePdfVerticalAlignment_Center);
+            }
+
+            *this->out << waypointCount << " waypoint(s) added to PDF file\n";
+        }
 
         painter.FinishPage();
 
         if (convertError)
-            std::cout << "Error converting waypoint coordinates.\n";
+            *this->out << "Error converting waypoint coordinates.\n";
 
         if (waypointCount <= 0) {
-            std::cout << "No waypoints are within the page limits. Output file not written.\n";
+            *this->out << "No waypoints are within the page limits. Output file not written.\n";
             delete docPodofo;
             return gpx2pdf::INVALID_ARGUMENT;
         }
 
     } catch(PoDoFo::PdfError& pdfError) {
-        std::cout << "Error printing to PDF: " << pdfError.what() << "\n";
+        *this->out << "Error printing to PDF: " << pdfError.what() << "\n";
         delete docPodofo;
         return gpx2pdf::ERROR;
     } catch(...) {
-        std::cout << "Error printing to PDF\n";
+        *this->out << "Error printing to PDF\n";
         delete docPodofo;
         return gpx2pdf::ERROR;
     }
 
     // Write the finished PDF to file
     try {
-        docPodofo->Write(this->pdfFileOut.c_str());
+        if (this->lowMemory && !docPodofo->GetEncrypted()) {
+            // Copies the input file and appends the changed objects, so the unchanged objects never need to be loaded.
+            // The device truncates the output, otherwise the tail of an existing larger file would be left after the update
+            PoDoFo::PdfOutputDevice device(this->pdfFileOut.c_str(), true);
+            docPodofo->WriteUpdate(&device, true);
+        } else {
+            if (this->lowMemory)
+                *this->out << "PDF file is encrypted, writing the whole file\n";
+            docPodofo->Write(this->pdfFileOut.c_str());
+        }
     }catch(PoDoFo::PdfError& pdfError){
-        std::cout << "Error writting PDF file: " << pdfError.what() << "\n";
+        *this->out << "Error writting PDF file: " << pdfError.what() << "\n";
         delete docPodofo;
         return gpx2pdf::ERROR;
     }
@@ -313,42 +462,54 @@ gpx2pdf::g2pErr gpx2pdf::savePdf() {
 }
 
 gpx2pdf::g2pErr gpx2pdf::getGeospatialData() {
-    std::cout << "Extracting Geospatial Data from PDF file: " << this->pdfFileIn << "\n";
+    *this->out << "Extracting Geospatial Data from PDF file: " << this->pdfFileIn << "\n";
 
     GDALAllRegister();
 
-    // Load PDF file with GDAL
+    // Load PDF file with GDAL, pages after the first are opened as subdatasets
+    std::string gdalFileName = this->pdfFileIn;
+    if (this->pageNumber > 1)
+        gdalFileName = "PDF:" + std::to_string(this->pageNumber) + ":" + this->pdfFileIn;
+
     std::string optionStr = "USER_PWD=" + this->pdfPassword;
     const char* options[2] = {optionStr.c_str(), nullptr};
-    GDALDataset *pdfDataset = static_cast<GDALDataset*>(GDALDataset::Open(this->pdfFileIn.c_str(), GA_ReadOnly, nullptr, this->pdfPassword.size() ? options : nullptr));
+    GDALDataset *pdfDataset = static_cast<GDALDataset*>(GDALDataset::Open(gdalFileName.c_str(), GA_ReadOnly, nullptr, this->pdfPassword.size() ? options : nullptr));
     if (!pdfDataset) {
-        std::cout << "Unable to open PDF file for reading: " << this->pdfFileIn << "\n";
+        *this->out << "Unable to open PDF file for reading: " << this->pdfFileIn << "\n";
         return gpx2pdf::FILE_ERROR;
     }
 
+    // Multi page PDFs list each page as a subdataset (a NAME and DESC item per page)
+    if (this->pageNumber <= 1) {
+        char** subdatasets = pdfDataset->GetMetadata("SUBDATASETS");
+        this->pageCount = subdatasets ? CSLCount(subdatasets) / 2 : 1;
+    }
+
     // Get a copy of the adfGeoTransform variable
     if (pdfDataset->GetGeoTransform(this->adfGeoTransform) == CE_None) {
 
-        std::cout << std::fixed;
-        std::cout << "Geospatial data found: Origin = (" << adfGeoTransform[0] << ", " << adfGeoTransform[3] << "), Pixel Size = (" << adfGeoTransform[1] << ", " << adfGeoTransform[5] << ")\n";
+        *this->out << std::fixed;
+        *this->out << "Geospatial data found: Origin = (" << adfGeoTransform[0] << ", " << adfGeoTransform[3] << "), Pixel Size = (" << adfGeoTransform[1] << ", " << adfGeoTransform[5] << ")\n";
 
         // Get page size in pixels
         this->xPixels = pdfDataset->GetRasterXSize();
         this->yPixels = pdfDataset->GetRasterYSize();
 
+        // The PDF driver reports the DPI it used, otherwise fall back to the same default the driver uses
+        const char* dpiStr = pdfDataset->GetMetadataItem("DPI");
+        this->dpi = std::atof(dpiStr ? dpiStr : CPLGetConfigOption("GDAL_PDF_DPI", "150"));
+
         if (pdfDataset->GetSpatialRef()) {
-            this->pdfSRS = pdfDataset->GetSpatialRef()->Clone();
-            if (this->pdfSRS)
-                this->coordTF = OGRCreateCoordinateTransformation(&this->WGS84, this->pdfSRS);
+            this->setSpatialRef(pdfDataset->GetSpatialRef()->Clone());
         } else {
-            std::cout << "Error: null return from GetSpatialRef\n";
+            *this->out << "Error: null return from GetSpatialRef\n";
             GDALClose(pdfDataset);
             return gpx2pdf::ERROR;
         }
 
     } else {
         // adfGeoTransform is not set, so likely not a GeoPDF
-        std::cout << "Geospatial data not found, are you sure this is a GeoPDF?\n";
+        *this->out << "Geospatial data not found, are you sure this is a GeoPDF?\n";
         GDALClose(pdfDataset);
         return gpx2pdf::PARSE_ERROR;
     }
@@ -357,6 +518,26 @@ gpx2pdf::g2pErr gpx2pdf::getGeospatialData() {
     return gpx2pdf::SUCCESS;
 }
 
+gpx2pdf::g2pErr gpx2pdf::setGeospatialData(const double *geoTransform, std::string srsWkt, int xPixels, int yPixels) {
+    OGRSpatialReference* srs = new OGRSpatialReference();
+    if (srs->importFromWkt(srsWkt.c_str()) != OGRERR_NONE) {
+        *this->out << "Invalid spatial reference system\n";
+        OGRSpatialReference::DestroySpatialReference(srs);
+        return gpx2pdf::PARSE_ERROR;
+    }
+
+    // GDAL datasets use x/y (easting/northing) order, so match that here
+    srs->SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+
+    for (int i = 0; i < 6; i++)
+        this->adfGeoTransform[i] = geoTransform[i];
+    this->xPixels = xPixels;
+    this->yPixels = yPixels;
+    this->setSpatialRef(srs);
+
+    return gpx2pdf::SUCCESS;
+}
+
 void gpx2pdf::setPageNumber(int pageNumber) {
     this->pageNumber = pageNumber;
 }
@@ -381,6 +562,135 @@ void gpx2pdf::setNameFontSize(double nameFontSize) {
     this->nameFontSize = nameFontSize;
 }
 
+void gpx2pdf::setLowMemoryMode(bool lowMemory) {
+    this->lowMemory = lowMemory;
+}
+
+void gpx2pdf::setAggregationMode(g2pAggregation aggregationMode) {
+    this->aggregationMode = aggregationMode;
+}
+
+void gpx2pdf::setAggregationThreshold(int aggregationThreshold) {
+    this->aggregationThreshold = aggregationThreshold;
+}
+
+void gpx2pdf::setAggregationCellSize(double aggregationCellSize) {
+    this->aggregationCellSize = aggregationCellSize;
+}
+
+gpx2pdf::g2pErr gpx2pdf::getPixelWaypoints(std::vector<pixelWaypoint> *pixelWaypoints) {
+    if (!pixelWaypoints)
+        return gpx2pdf::INVALID_ARGUMENT;
+
+    pixelWaypoints->clear();
+    pixelWaypoints->reserve(this->waypoints->size());
+    for (unsigned int i = 0; i < this->waypoints->size(); i++) {
+        double x = 0, y = 0;
+        if (convertCoordsToPixels(this->waypoints->at(i).lat, this->waypoints->at(i).lon, &x, &y) == g2pErr::SUCCESS)
+            pixelWaypoints->push_back({x, y, this->waypoints->at(i).name});
+    }
+
+    if (pixelWaypoints->size() < 1)
+        return gpx2pdf::EMPTY_DATA;
+
+    return gpx2pdf::SUCCESS;
+}
+
+int gpx2pdf::getXPixels() {
+    return this->xPixels;
+}
+
+int gpx2pdf::getYPixels() {
+    return this->yPixels;
+}
+
+double gpx2pdf::getDpi() {
+    return this->dpi;
+}
+
+int gpx2pdf::getPageCount() {
+    return this->pageCount;
+}
+
+std::shared_ptr<const std::vector<gpx2pdf::waypoint>> gpx2pdf::getWaypoints() {
+    return this->waypoints;
+}
+
+void gpx2pdf::setWaypoints(std::shared_ptr<const std::vector<waypoint>> waypoints) {
+    this->waypoints = waypoints ? waypoints : std::make_shared<std::vector<waypoint>>();
+}
+
+void gpx2pdf::setOutputStream(std::ostream *out) {
+    this->out = out ? out : &std::cout;
+}
+
+void gpx2pdf::getGeoTransform(double *geoTransform) {
+    for (int i = 0; i < 6; i++)
+        geoTransform[i] = this->adfGeoTransform[i];
+}
+
+std::string gpx2pdf::getSpatialRefWkt() {
+    if (!this->pdfSRS)
+        return "";
+
+    char* wkt = nullptr;
+    std::string result;
+    if (this->pdfSRS->exportToWkt(&wkt) == OGRERR_NONE && wkt)
+        result = wkt;
+    CPLFree(wkt);
+    return result;
+}
+
+gpx2pdf::g2pErr gpx2pdf::getPageBounds(double *minLat, double *minLon, double *maxLat, double *maxLon) {
+    if (!this->pdfSRS || this->xPixels <= 0 || this->yPixels <= 0)
+        return gpx2pdf::ERROR;
+
+    OGRCoordinateTransformation *inverseTF = OGRCreateCoordinateTransformation(this->pdfSRS, &this->WGS84);
+    if (!inverseTF)
+        return gpx2pdf::ERROR;
+
+    // Sample points along each edge of the page, as the page edges are not straight lines in WGS84
+    const int steps = 8;
+    std::vector<double> x, y;
+    for (int i = 0; i <= steps; i++) {
+        double p = this->xPixels * i / static_cast<double>(steps);
+        double l = this->yPixels * i / static_cast<double>(steps);
+        double edges[4][2] = {{p, 0}, {p, static_cast<double>(this->yPixels)}, {0, l}, {static_cast<double>(this->xPixels), l}};
+        for (int j = 0; j < 4; j++) {
+            // From GDAL docs
+            // Xp = adfGeoTransform[0] + P*adfGeoTransform[1] + L*adfGeoTransform[2];
+            // Yp = adfGeoTransform[3] + P*adfGeoTransform[4] + L*adfGeoTransform[5];
+            x.push_back(this->adfGeoTransform[0] + edges[j][0] * this->adfGeoTransform[1] + edges[j][1] * this->adfGeoTransform[2]);
+            y.push_back(this->adfGeoTransform[3] + edges[j][0] * this->adfGeoTransform[4] + edges[j][1] * this->adfGeoTransform[5]);
+        }
+    }
+
+    // The WGS84 output is lat/lon, the same order that convertCoordsToPixels() uses for input
+    bool transformed = inverseTF->Transform(static_cast<int>(x.size()), x.data(), y.data());
+    OCTDestroyCoordinateTransformation(inverseTF);
+    if (!transformed)
+        return gpx2pdf::INVALID_ARGUMENT;
+
+    *minLat = *std::min_element(x.begin(), x.end());
+    *maxLat = *std::max_element(x.begin(), x.end());
+    *minLon = *std::min_element(y.begin(), y.end());
+    *maxLon = *std::max_element(y.begin(), y.end());
+
+    return gpx2pdf::SUCCESS;
+}
+
+void gpx2pdf::setSpatialRef(OGRSpatialReference* srs) {
+    if (this->coordTF)
+        OCTDestroyCoordinateTransformation(this->coordTF);
+    if (this->pdfSRS)
+        OGRSpatialReference::DestroySpatialReference(this->pdfSRS);
+
+    this->pdfSRS = srs;
+    this->coordTF = nullptr;
+    if (this->pdfSRS)
+        this->coordTF = OGRCreateCoordinateTransformation(&this->WGS84, this->pdfSRS);
+}
+
 gpx2pdf::g2pErr gpx2pdf::convertCoordsToPixels(double lat, double lon, double *x, double *y) {
     // if there is no coordinate transformation loaded, then the conversion can not be done
     if (!this->coordTF)
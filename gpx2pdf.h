@@ -5,12 +5,14 @@
 
   @section DESCRIPTION
   A class that reads waypoints from a GPX file and places them on a map from a GeoPDF file
-  The status is outputed to std::cout as the data is processed
+  The status is outputed to std::cout (or the stream set with setOutputStream()) as the data is processed
  */
 
 #ifndef GPX2PDF_H
 #define GPX2PDF_H
 
+#include <memory>
+#include <ostream>
 #include <string>
 #include <vector>
 
@@ -25,7 +27,7 @@ public:
 
       @param gpxFile is the GPX file with the waypoints to put on the PDF file. Read permissions for this file are required.
       @param pdfFileIn is the GeoPDF file that contains the map to put the waypoints on. This file is not modified. Read permissions for this file are required.
-      @param pdfFileOut is where the PDF file with the waypoints is written to. Write permissions for this file are required.
+      @param pdfFileOut is where the PDF file with the waypoints is written to, it must not be the same file as pdfFileIn. Write permissions for this file are required.
     */
     gpx2pdf(std::string gpxFile, std::string pdfFileIn, std::string pdfFileOut);
 
@@ -45,6 +47,14 @@ public:
         PARSE_ERROR = 5
     } g2pErr;
 
+    // Ways of drawing pages with a lot of waypoints on them
+    typedef enum
+    {
+        AGGREGATE_NONE = 0,
+        AGGREGATE_CLUSTER = 1,
+        AGGREGATE_HEATMAP = 2
+    } g2pAggregation;
+
     /**
       Do the conversion, and save to file if successful.
 
@@ -62,7 +72,7 @@ public:
 
       @param gpxFile is the GPX file with the waypoints to put on the PDF file. Read permissions for this file are required.
       @param pdfFileIn is the GeoPDF file that contains the map to put the waypoints on. This file is not modified. Read permissions for this file are required.
-      @param pdfFileOut is where the PDF file with the waypoints is written to. Write permissions for this file are required.
+      @param pdfFileOut is where the PDF file with the waypoints is written to, it must not be the same file as pdfFileIn. Write permissions for this file are required.
       @return SUCCESS if all steps are successful, and error code otherwise.
     */
     static g2pErr doConversion(std::string gpxFile, std::string pdfFileIn, std::string pdfFileOut);
@@ -79,12 +89,25 @@ public:
     /**
       Get the geospatial data from the GeoPDF file.
 
-      Reads the PDF file and extracts the geospatial data.
+      Reads the PDF file and extracts the geospatial data for the page set by setPageNumber().
 
       @return SUCCESS if the geospatial data is found, and error code otherwise.
     */
     g2pErr getGeospatialData();
 
+    /**
+      Sets the geospatial data directly instead of reading it from the GeoPDF file.
+
+      Can be used in place of getGeospatialData() when the data has already been read, for example from a map catalog.
+
+      @param geoTransform is the GDAL geotransform of the page (6 values).
+      @param srsWkt is the spatial reference system of the page as WKT.
+      @param xPixels is the width of the page in pixels, as rendered by GDAL.
+      @param yPixels is the height of the page in pixels, as rendered by GDAL.
+      @return SUCCESS if the spatial reference system is valid, and error code otherwise.
+    */
+    g2pErr setGeospatialData(const double *geoTransform, std::string srsWkt, int xPixels, int yPixels);
+
     /**
       Creates and saves the PDF file with waypoints.
 
@@ -136,7 +159,45 @@ public:
     */
     void setNameFontSize(double nameFontSize);
 
-private:
+    /**
+      Sets whether to load the input PDF file in low memory mode.
+
+      In low memory mode only the objects that are needed to draw on the page are read from the input PDF file.
+      The output file is written as an incremental update, so the original file is copied through unchanged
+      and only the new and modified objects are appended to it. Large raster images in the map are never loaded.
+      Encrypted PDF files are always written in full.
+
+      @param lowMemory is set to true to use low memory mode.
+    */
+    void setLowMemoryMode(bool lowMemory);
+
+    /**
+      Sets how to draw pages that have more waypoints on them than the aggregation threshold.
+
+      The waypoints on the page are grouped into a grid of square cells. AGGREGATE_CLUSTER draws a circle
+      with the number of waypoints in it for each cell, AGGREGATE_HEATMAP fills each cell with a colour for the number of waypoints.
+      The individual waypoints and names are not drawn.
+
+      @param aggregationMode is the aggregation mode (AGGREGATE_NONE to always draw every waypoint).
+    */
+    void setAggregationMode(g2pAggregation aggregationMode);
+
+    /**
+      Sets the number of waypoints on a page above which the aggregation mode is used.
+
+      @param aggregationThreshold is the maximum number of waypoints to draw individually.
+    */
+    void setAggregationThreshold(int aggregationThreshold);
+
+    /**
+      Sets the size of the grid cells that waypoints are grouped into.
+
+      Values below 1 are treated as 1. The cells are made larger if the page would need more than 250000 of them.
+
+      @param aggregationCellSize is the width and height of each cell, in PDF units (at least 1).
+    */
+    void setAggregationCellSize(double aggregationCellSize);
+
     /**
       An object to store a waypoint in.
     */
@@ -146,6 +207,118 @@ private:
         std::string name;
     };
 
+    /**
+      Gets the waypoints that were read by loadGpx().
+
+      The list is shared, not copied, so it can be passed to setWaypoints() of other objects.
+
+      @return the waypoints (WGS84, decimal degrees).
+    */
+    std::shared_ptr<const std::vector<waypoint>> getWaypoints();
+
+    /**
+      Sets the waypoints directly instead of reading them with loadGpx().
+
+      Used to share one list of waypoints between several conversions of the same GPX file.
+
+      @param waypoints are the waypoints (WGS84, decimal degrees), as returned by getWaypoints().
+    */
+    void setWaypoints(std::shared_ptr<const std::vector<waypoint>> waypoints);
+
+    /**
+      Sets the stream that the status is written to.
+
+      @param out is the stream to write to (std::cout by default). It must outlive this object.
+    */
+    void setOutputStream(std::ostream *out);
+
+    /**
+      Sets up the global settings of the PDF library.
+
+      Called by savePdf(), but should also be called before starting conversions on other threads.
+    */
+    static void initPdfLibrary();
+
+    /**
+      An object to store a waypoint after it has been converted to pixel coordinates.
+    */
+    struct pixelWaypoint {
+        double x;
+        double y;
+        std::string name;
+    };
+
+    /**
+      Converts all the loaded waypoints to pixel coordinates on the page.
+
+      Both loadGpx() and getGeospatialData() must be called first.
+      Waypoints that fail to convert are skipped, waypoints that are off the page are included.
+
+      @param pixelWaypoints is a pointer to a vector where the converted waypoints will be placed.
+      @return SUCCESS if at least one waypoint was converted, and error code otherwise.
+    */
+    g2pErr getPixelWaypoints(std::vector<pixelWaypoint> *pixelWaypoints);
+
+    /**
+      Gets the width of the PDF page in pixels, as rendered by GDAL.
+
+      @return the width in pixels, or 0 if getGeospatialData() has not been called.
+    */
+    int getXPixels();
+
+    /**
+      Gets the height of the PDF page in pixels, as rendered by GDAL.
+
+      @return the height in pixels, or 0 if getGeospatialData() has not been called.
+    */
+    int getYPixels();
+
+    /**
+      Gets the resolution that GDAL rendered the PDF page at.
+
+      GDAL picks this from the images in the PDF unless it is set with GDAL_PDF_DPI, so it can't be assumed.
+
+      @return the number of pixels per inch (72 PDF units), or 0 if getGeospatialData() has not been called.
+    */
+    double getDpi();
+
+    /**
+      Gets the number of pages in the PDF file.
+
+      GDAL only lists the pages when the first page is opened, so this is only known if getGeospatialData() was called with page number 1.
+
+      @return the number of pages, or 0 if it is not known.
+    */
+    int getPageCount();
+
+    /**
+      Gets the geotransform of the page, as found by getGeospatialData().
+
+      @param geoTransform is a pointer to an array of 6 values where the geotransform will be placed.
+    */
+    void getGeoTransform(double *geoTransform);
+
+    /**
+      Gets the spatial reference system of the page, as found by getGeospatialData().
+
+      @return the spatial reference system as WKT, or an empty string if there is none.
+    */
+    std::string getSpatialRefWkt();
+
+    /**
+      Gets the area covered by the page in WGS84 coordinates.
+
+      Points along the edges of the page are converted, so the result contains the whole page even when it is not aligned to north.
+
+      @param minLat is a pointer to a variable where the minimum latitude will be placed.
+      @param minLon is a pointer to a variable where the minimum longitude will be placed.
+      @param maxLat is a pointer to a variable where the maximum latitude will be placed.
+      @param maxLon is a pointer to a variable where the maximum longitude will be placed.
+      @return SUCCESS if the page corners could be converted, and error code otherwise.
+    */
+    g2pErr getPageBounds(double *minLat, double *minLon, double *maxLat, double *maxLon);
+
+private:
     /**
       Converts lat/lon coordinates to pixel coordinates.
 
@@ -159,6 +332,13 @@ private:
     */
     g2pErr convertCoordsToPixels(double lat, double lon, double *x, double *y);
 
+    /**
+      Sets the spatial reference system of the PDF page and creates the coordinate transform for it.
+
+      @param srs is the spatial reference system, this object takes ownership of it.
+    */
+    void setSpatialRef(OGRSpatialReference* srs);
+
     std::string gpxFile;               /*!< Stores the GPX file path */
     std::string pdfFileIn;             /*!< Stores the input PDF file path */
     std::string pdfFileOut;            /*!< Stores the output PDF file path */
@@ -168,8 +348,13 @@ private:
     bool useGsakSmartName;             /*!< Use GSAK smart name instead of waypoint name if it is available */
     int maxNameLength;                 /*!< Max length of name to print on the map, any characters after this length are ignored (set to -1 for no limit) */
     double nameFontSize;               /*!< Font size to use when printing waypoint names */
+    bool lowMemory;                    /*!< Load the input PDF on demand and write the output as an incremental update */
+    g2pAggregation aggregationMode;    /*!< How to draw pages with more than aggregationThreshold waypoints */
+    int aggregationThreshold;          /*!< Max number of waypoints on a page before the aggregation mode is used */
+    double aggregationCellSize;        /*!< Size of the grid cells used by the aggregation mode, in PDF units */
 
-    std::vector<waypoint> waypoints;   /*!< Vector to store the waypoints after reading them from file */
+    std::shared_ptr<const std::vector<waypoint>> waypoints;  /*!< Vector to store the waypoints after reading them from file */
+    std::ostream* out;                 /*!< Stream the status is written to */
 
     OGRSpatialReference* pdfSRS;
     OGRSpatialReference WGS84;
@@ -178,6 +363,8 @@ private:
 
     int xPixels;                       /*!< Width of the PDF page in pixels, comes from GDAL */
     int yPixels;                       /*!< Height of the PDF page in pixels, comes from GDAL */
+    double dpi;                        /*!< Pixels per inch of the PDF page, comes from GDAL */
+    int pageCount;                     /*!< Number of pages in the PDF file, comes from GDAL (0 if not known) */
 
 };
 
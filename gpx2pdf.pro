@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui xml
+QT       += core gui xml concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -27,10 +27,14 @@ CONFIG += c++11
 SOURCES += \
         main.cpp \
         mainwindow.cpp \
+        mappreview.cpp \
+        mapcatalog.cpp \
         gpx2pdf.cpp
 
 HEADERS += \
         mainwindow.h \
+        mappreview.h \
+        mapcatalog.h \
         gpx2pdf.h
 
 FORMS += \
@@ -10,21 +10,113 @@
 #include "mainwindow.h"
 #include <QApplication>
 
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "gpx2pdf.h"
+#include "mapcatalog.h"
 
 int main(int argc, char *argv[])
 {
     if (argc > 1) {
         // if there are args then run in the command line
 
-        if (argc == 4) {
-            std::string gpxFile = std::string(argv[1]);
-            std::string pdfFileIn = std::string(argv[2]);
-            std::string pdfFileOut = std::string(argv[3]);
+        // options start with "--", everything else is a file name
+        std::vector<std::string> files;
+        bool lowMemory = false;
+        bool buildCatalog = false;
+        bool useCatalog = false;
+        bool cluster = false;
+        bool heatmap = false;
+        int aggregationThreshold = 1000;
+        double aggregationCellSize = 30.0;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = std::string(argv[i]);
+            if (arg == "--low-memory") {
+                lowMemory = true;
+            } else if (arg == "--catalog") {
+                buildCatalog = true;
+            } else if (arg == "--use-catalog") {
+                useCatalog = true;
+            } else if (arg == "--cluster") {
+                cluster = true;
+            } else if (arg == "--heatmap") {
+                heatmap = true;
+            } else if (arg.compare(0, 22, "--aggregate-threshold=") == 0) {
+                // must be a whole number that is not negative
+                std::string valueStr = arg.substr(22);
+                char* end = nullptr;
+                errno = 0;
+                long value = std::strtol(valueStr.c_str(), &end, 10);
+                if (valueStr.empty() || *end != '\0' || errno == ERANGE || value < 0 || value > INT_MAX) {
+                    std::cout << "Invalid value for option: " << arg << "\n";
+                    return 0;
+                }
+                aggregationThreshold = static_cast<int>(value);
+            } else if (arg.compare(0, 22, "--aggregate-cell-size=") == 0) {
+                // must be a number of at least 1 (PDF units)
+                std::string valueStr = arg.substr(22);
+                char* end = nullptr;
+                errno = 0;
+                double value = std::strtod(valueStr.c_str(), &end);
+                if (valueStr.empty() || *end != '\0' || errno == ERANGE || !(value >= 1)) {
+                    std::cout << "Invalid value for option: " << arg << "\n";
+                    return 0;
+                }
+                aggregationCellSize = value;
+            } else if (arg.compare(0, 2, "--") == 0) {
+                std::cout << "Unknown option: " << arg << "\n";
+                return 0;
+            } else {
+                files.push_back(arg);
+            }
+        }
+
+        if (cluster && heatmap) {
+            std::cout << "Options --cluster and --heatmap can not be used together\n";
+            return 0;
+        }
+        gpx2pdf::g2pAggregation aggregationMode = gpx2pdf::AGGREGATE_NONE;
+        if (cluster)
+            aggregationMode = gpx2pdf::AGGREGATE_CLUSTER;
+        if (heatmap)
+            aggregationMode = gpx2pdf::AGGREGATE_HEATMAP;
+
+        if (buildCatalog) {
+            if (files.size() == 2) {
+                if (mapcatalog::buildCatalog(files.at(0), files.at(1)) == gpx2pdf::SUCCESS) {
+                    std::cout << "Map catalog successfully created\n";
+                }
+            } else {
+                std::cout << "Expected 2 arguments with --catalog: map_directory, index_file\n";
+            }
+
+        } else if (useCatalog) {
+            if (files.size() == 3) {
+                mapcatalog catalog(files.at(0));
+                catalog.setLowMemoryMode(lowMemory);
+                catalog.setAggregationMode(aggregationMode);
+                catalog.setAggregationThreshold(aggregationThreshold);
+                catalog.setAggregationCellSize(aggregationCellSize);
+
+                if (catalog.load() == gpx2pdf::SUCCESS && catalog.convert(files.at(1), files.at(2)) == gpx2pdf::SUCCESS) {
+                    std::cout << "GPX waypoints successfully added to PDF files\n";
+                }
+            } else {
+                std::cout << "Expected 3 arguments with --use-catalog: index_file, gpx_file, output_directory\n";
+            }
+
+        } else if (files.size() == 3) {
+            gpx2pdf converter(files.at(0), files.at(1), files.at(2));
+            converter.setLowMemoryMode(lowMemory);
+            converter.setAggregationMode(aggregationMode);
+            converter.setAggregationThreshold(aggregationThreshold);
+            converter.setAggregationCellSize(aggregationCellSize);
 
-            if (gpx2pdf::doConversion(gpxFile, pdfFileIn, pdfFileOut) == gpx2pdf::SUCCESS) {
+            if (converter.doConversion() == gpx2pdf::SUCCESS) {
                 std::cout << "GPX waypoints successfully added to PDF file\n";
             }
 
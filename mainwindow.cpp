@@ -5,7 +5,7 @@
 
   @section DESCRIPTION
   A Qt GUI window that allows the user to browse and select files.
-  Then launches the gpx2pdf conversion.
+  Then shows a preview of the waypoints on the map, or launches the gpx2pdf conversion.
  */
 
 #include "mainwindow.h"
@@ -28,6 +28,14 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(this->ui->pdfInBrowseButton, SIGNAL(clicked(bool)), this, SLOT(pdfInBrowseButtonClicked(bool)));
     connect(this->ui->pdfOutBrowseButton, SIGNAL(clicked(bool)), this, SLOT(pdfOutBrowseButtonClicked(bool)));
     connect(this->ui->startButton, SIGNAL(clicked(bool)), this, SLOT(startButtonClicked(bool)));
+    connect(this->ui->previewButton, SIGNAL(clicked(bool)), this, SLOT(previewButtonClicked(bool)));
+
+    // the preview is redrawn when these change, without doing a conversion
+    connect(this->ui->nameLengthSpinBox, SIGNAL(valueChanged(int)), this, SLOT(nameLengthChanged(int)));
+    connect(this->ui->fontSizeSpinBox, SIGNAL(valueChanged(double)), this, SLOT(fontSizeChanged(double)));
+    connect(this->ui->geocacheNameCheckBox, SIGNAL(toggled(bool)), this, SLOT(nameOptionToggled(bool)));
+    connect(this->ui->smartNameCheckBox, SIGNAL(toggled(bool)), this, SLOT(nameOptionToggled(bool)));
+    connect(this->ui->mapPreview, SIGNAL(renderFailed(QString)), this, SLOT(previewRenderFailed(QString)));
 
 }
 
@@ -72,3 +80,52 @@ void MainWindow::startButtonClicked(bool) {
     std::cout.rdbuf(old);
     this->ui->statusTextEdit->setPlainText(QString::fromStdString(buffer.str()));
 }
+
+void MainWindow::previewButtonClicked(bool) {
+    this->loadPreview(true);
+}
+
+void MainWindow::nameLengthChanged(int maxNameLength) {
+    this->ui->mapPreview->setMaxNameLength(maxNameLength);
+}
+
+void MainWindow::fontSizeChanged(double nameFontSize) {
+    this->ui->mapPreview->setNameFontSize(nameFontSize);
+}
+
+void MainWindow::nameOptionToggled(bool) {
+    // the names come from the GPX file, so it needs to be read again
+    if (this->ui->mapPreview->hasMap())
+        this->loadPreview(false);
+}
+
+void MainWindow::loadPreview(bool reloadMap) {
+    std::stringstream buffer;
+    std::streambuf * old = std::cout.rdbuf(buffer.rdbuf());
+
+    // the names are not truncated here so that the preview can change the max length without reading the GPX file again
+    gpx2pdf converter(this->ui->gpxFileLineEdit->text().toStdString(), this->ui->pdfFileInLineEdit->text().toStdString(), "");
+    converter.setUseGeocacheName(this->ui->geocacheNameCheckBox->isChecked());
+    converter.setUseGsakSmartName(this->ui->smartNameCheckBox->isChecked());
+    converter.setMaxNameLength(-1);
+
+    std::vector<gpx2pdf::pixelWaypoint> pixelWaypoints;
+    if (converter.loadGpx() == gpx2pdf::SUCCESS && converter.getGeospatialData() == gpx2pdf::SUCCESS) {
+        converter.getPixelWaypoints(&pixelWaypoints);
+
+        if (reloadMap || !this->ui->mapPreview->hasMap())
+            this->ui->mapPreview->setMap(this->ui->pdfFileInLineEdit->text(), converter.getXPixels(), converter.getYPixels(), converter.getDpi());
+        this->ui->mapPreview->setMaxNameLength(this->ui->nameLengthSpinBox->value());
+        this->ui->mapPreview->setNameFontSize(this->ui->fontSizeSpinBox->value());
+        this->ui->mapPreview->setWaypoints(pixelWaypoints);
+
+        std::cout << pixelWaypoints.size() << " waypoint(s) shown in preview\n";
+    }
+
+    std::cout.rdbuf(old);
+    this->ui->statusTextEdit->setPlainText(QString::fromStdString(buffer.str()));
+}
+
+void MainWindow::previewRenderFailed(const QString &message) {
+    this->ui->statusTextEdit->appendPlainText(message);
+}
@@ -5,7 +5,7 @@
 
   @section DESCRIPTION
   A Qt GUI window that allows the user to browse and select files.
-  Then launches the gpx2pdf conversion.
+  Then shows a preview of the waypoints on the map, or launches the gpx2pdf conversion.
  */
 
 #ifndef MAINWINDOW_H
@@ -31,8 +31,22 @@ private slots:
     void pdfInBrowseButtonClicked(bool);
     void pdfOutBrowseButtonClicked(bool);
     void startButtonClicked(bool);
+    void previewButtonClicked(bool);
+
+    // slots for the options that change how the preview is drawn
+    void nameLengthChanged(int);
+    void fontSizeChanged(double);
+    void nameOptionToggled(bool);
+    void previewRenderFailed(const QString &message);
 
 private:
+    /**
+      Loads the waypoints and geospatial data for the preview.
+
+      @param reloadMap is set to true to load the map again, otherwise only the waypoints are loaded.
+    */
+    void loadPreview(bool reloadMap);
+
     Ui::MainWindow *ui;
 };
 
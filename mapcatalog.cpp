@@ -0,0 +1,425 @@
+/**
+  @file    mapcatalog.cpp
+  @author  Ben <admin@laighside.com>
+  @version 1.0
+
+  @section DESCRIPTION
+  A catalog of GeoPDF map sheets, used to find every sheet that has waypoints from a GPX file on it.
+  The catalog is built once by scanning a directory and saved to an index file.
+  The status is outputed to std::cout as the data is processed
+ */
+
+#include "mapcatalog.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+
+#include <QDataStream>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <cpl_conv.h>
+
+#define MAPCATALOG_MAGIC    0x47325043  // "G2PC"
+#define MAPCATALOG_VERSION  1
+
+mapcatalog::mapcatalog(std::string indexFile) {
+    this->indexFile = indexFile;
+    this->lowMemory = false;
+    this->aggregationMode = gpx2pdf::AGGREGATE_NONE;
+    this->aggregationThreshold = 1000;
+    this->aggregationCellSize = 30.0;
+    this->spatialIndex = nullptr;
+}
+
+mapcatalog::~mapcatalog() {
+    if (this->spatialIndex)
+        CPLQuadTreeDestroy(this->spatialIndex);
+}
+
+gpx2pdf::g2pErr mapcatalog::buildCatalog(std::string mapDirectory, std::string indexFile) {
+    mapcatalog instance(indexFile);
+    return instance.build(mapDirectory);
+}
+
+void mapcatalog::setLowMemoryMode(bool lowMemory) {
+    this->lowMemory = lowMemory;
+}
+
+void mapcatalog::setAggregationMode(gpx2pdf::g2pAggregation aggregationMode) {
+    this->aggregationMode = aggregationMode;
+}
+
+void mapcatalog::setAggregationThreshold(int aggregationThreshold) {
+    this->aggregationThreshold = aggregationThreshold;
+}
+
+void mapcatalog::setAggregationCellSize(double aggregationCellSize) {
+    this->aggregationCellSize = aggregationCellSize;
+}
+
+gpx2pdf::g2pErr mapcatalog::build(std::string mapDirectory) {
+    std::cout << "Scanning for GeoPDF files in: " << mapDirectory << "\n";
+
+    if (!QFileInfo(QString::fromStdString(mapDirectory)).isDir()) {
+        std::cout << "Map directory does not exist: " << mapDirectory << "\n";
+        return gpx2pdf::FILE_ERROR;
+    }
+
+    this->sheets.clear();
+    this->srsList.clear();
+
+    QDirIterator it(QString::fromStdString(mapDirectory), QStringList() << "*.pdf" << "*.PDF", QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        std::string pdfFile = QFileInfo(it.next()).absoluteFilePath().toStdString();
+
+        // The number of pages is only known after reading the first one
+        // Page 1 is often a cover or legend without geospatial data, so the other pages are still tried
+        int pageCount = 0;
+        this->addSheet(pdfFile, 1, &pageCount);
+
+        for (int page = 2; page <= pageCount; page++)
+            this->addSheet(pdfFile, page, nullptr);
+    }
+
+    std::cout << this->sheets.size() << " map sheet(s) found\n";
+    if (this->sheets.size() < 1)
+        return gpx2pdf::EMPTY_DATA;
+
+    this->buildSpatialIndex();
+    return this->save();
+}
+
+gpx2pdf::g2pErr mapcatalog::addSheet(std::string pdfFile, int pageNumber, int *pageCount) {
+    gpx2pdf reader("", pdfFile, "");
+    reader.setPageNumber(pageNumber);
+
+    // The page count is found when the file is opened, even if the page has no geospatial data
+    gpx2pdf::g2pErr result = reader.getGeospatialData();
+    if (pageCount)
+        *pageCount = reader.getPageCount();
+    if (result != gpx2pdf::SUCCESS)
+        return result;
+
+    sheet mapSheet;
+    result = reader.getPageBounds(&mapSheet.minLat, &mapSheet.minLon, &mapSheet.maxLat, &mapSheet.maxLon);
+    if (result != gpx2pdf::SUCCESS) {
+        std::cout << "Unable to find the area covered by page " << pageNumber << "\n";
+        return result;
+    }
+
+    QDir indexDir = QFileInfo(QString::fromStdString(this->indexFile)).absoluteDir();
+    mapSheet.pdfFile = indexDir.relativeFilePath(QString::fromStdString(pdfFile)).toStdString();
+    mapSheet.pageNumber = pageNumber;
+    mapSheet.xPixels = reader.getXPixels();
+    mapSheet.yPixels = reader.getYPixels();
+    reader.getGeoTransform(mapSheet.geoTransform);
+
+    // Map series usually share a few SRS, so each one is only stored once
+    std::string srsWkt = reader.getSpatialRefWkt();
+    std::vector<std::string>::iterator srs = std::find(this->srsList.begin(), this->srsList.end(), srsWkt);
+    mapSheet.srsIndex = static_cast<unsigned int>(srs - this->srsList.begin());
+    if (srs == this->srsList.end())
+        this->srsList.push_back(srsWkt);
+
+    this->sheets.push_back(mapSheet);
+    return gpx2pdf::SUCCESS;
+}
+
+gpx2pdf::g2pErr mapcatalog::save() {
+    std::cout << "Writing catalog index file: " << this->indexFile << "\n";
+
+    QFile file(QString::fromStdString(this->indexFile));
+    if (!file.open(QIODevice::WriteOnly)) {
+        std::cout << "Unable to open index file for writing: " << this->indexFile << "\n";
+        return gpx2pdf::FILE_ERROR;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << static_cast<quint32>(MAPCATALOG_MAGIC) << static_cast<quint32>(MAPCATALOG_VERSION);
+
+    out << static_cast<quint32>(this->srsList.size());
+    for (unsigned int i = 0; i < this->srsList.size(); i++)
+        out << QByteArray::fromStdString(this->srsList.at(i));
+
+    out << static_cast<quint32>(this->sheets.size());
+    for (unsigned int i = 0; i < this->sheets.size(); i++) {
+        const sheet &mapSheet = this->sheets.at(i);
+        out << QString::fromStdString(mapSheet.pdfFile) << static_cast<qint32>(mapSheet.pageNumber);
+        out << static_cast<qint32>(mapSheet.xPixels) << static_cast<qint32>(mapSheet.yPixels);
+        out << mapSheet.minLat << mapSheet.minLon << mapSheet.maxLat << mapSheet.maxLon;
+        for (int j = 0; j < 6; j++)
+            out << mapSheet.geoTransform[j];
+        out << static_cast<quint32>(mapSheet.srsIndex);
+    }
+
+    file.close();
+    if (out.status() != QDataStream::Ok || file.error() != QFileDevice::NoError) {
+        std::cout << "Error writing index file\n";
+        return gpx2pdf::FILE_ERROR;
+    }
+
+    return gpx2pdf::SUCCESS;
+}
+
+gpx2pdf::g2pErr mapcatalog::load() {
+    std::cout << "Reading catalog index file: " << this->indexFile << "\n";
+
+    QFile file(QString::fromStdString(this->indexFile));
+    if (!file.open(QIODevice::ReadOnly)) {
+        std::cout << "Unable to open index file for reading: " << this->indexFile << "\n";
+        return gpx2pdf::FILE_ERROR;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0, version = 0;
+    in >> magic >> version;
+    if (magic != MAPCATALOG_MAGIC || version != MAPCATALOG_VERSION) {
+        std::cout << "Unable to parse index file - not a gpx2pdf catalog, or made by a different version\n";
+        return gpx2pdf::PARSE_ERROR;
+    }
+
+    this->sheets.clear();
+    this->srsList.clear();
+
+    quint32 srsCount = 0;
+    in >> srsCount;
+    for (quint32 i = 0; i < srsCount && in.status() == QDataStream::Ok; i++) {
+        QByteArray srsWkt;
+        in >> srsWkt;
+        this->srsList.push_back(srsWkt.toStdString());
+    }
+
+    quint32 sheetCount = 0;
+    in >> sheetCount;
+    for (quint32 i = 0; i < sheetCount && in.status() == QDataStream::Ok; i++) {
+        sheet mapSheet;
+        QString pdfFile;
+        qint32 pageNumber, xPixels, yPixels;
+        quint32 srsIndex;
+
+        in >> pdfFile >> pageNumber >> xPixels >> yPixels;
+        in >> mapSheet.minLat >> mapSheet.minLon >> mapSheet.maxLat >> mapSheet.maxLon;
+        for (int j = 0; j < 6; j++)
+            in >> mapSheet.geoTransform[j];
+        in >> srsIndex;
+
+        mapSheet.pdfFile = pdfFile.toStdString();
+        mapSheet.pageNumber = pageNumber;
+        mapSheet.xPixels = xPixels;
+        mapSheet.yPixels = yPixels;
+        mapSheet.srsIndex = srsIndex;
+        if (mapSheet.srsIndex >= this->srsList.size())
+            break;
+
+        this->sheets.push_back(mapSheet);
+    }
+    file.close();
+
+    if (in.status() != QDataStream::Ok || this->sheets.size() != sheetCount) {
+        std::cout << "Unable to parse index file - index file is not valid\n";
+        this->sheets.clear();
+        return gpx2pdf::PARSE_ERROR;
+    }
+
+    std::cout << this->sheets.size() << " map sheet(s) in catalog\n";
+    this->buildSpatialIndex();
+    return gpx2pdf::SUCCESS;
+}
+
+void mapcatalog::buildSpatialIndex() {
+    if (this->spatialIndex)
+        CPLQuadTreeDestroy(this->spatialIndex);
+
+    // x is longitude and y is latitude
+    CPLRectObj globalBounds = {-180.0, -90.0, 180.0, 90.0};
+    this->spatialIndex = CPLQuadTreeCreate(&globalBounds, nullptr);
+
+    // The quad tree holds pointers into sheets, so sheets must not change size after this
+    for (unsigned int i = 0; i < this->sheets.size(); i++) {
+        sheet &mapSheet = this->sheets.at(i);
+        CPLRectObj bounds = {mapSheet.minLon, mapSheet.minLat, mapSheet.maxLon, mapSheet.maxLat};
+        CPLQuadTreeInsertWithBounds(this->spatialIndex, &mapSheet, &bounds);
+    }
+}
+
+bool mapcatalog::hasWaypointOnSheet(const sheet &mapSheet, const std::vector<gpx2pdf::waypoint> &waypoints) {
+    // The bounding box is only a quick first test, a rotated or projected page doesn't fill it
+    std::shared_ptr<std::vector<gpx2pdf::waypoint>> inBounds = std::make_shared<std::vector<gpx2pdf::waypoint>>();
+    for (unsigned int i = 0; i < waypoints.size(); i++) {
+        if (waypoints.at(i).lat >= mapSheet.minLat && waypoints.at(i).lat <= mapSheet.maxLat &&
+            waypoints.at(i).lon >= mapSheet.minLon && waypoints.at(i).lon <= mapSheet.maxLon)
+            inBounds->push_back(waypoints.at(i));
+    }
+    if (inBounds->empty())
+        return false;
+
+    // Convert the waypoints to pixels the same way savePdf() does, using the geospatial data from the catalog
+    std::stringstream discard;
+    gpx2pdf converter("", "", "");
+    converter.setOutputStream(&discard);
+    converter.setWaypoints(inBounds);
+    if (converter.setGeospatialData(mapSheet.geoTransform, this->srsList.at(mapSheet.srsIndex), mapSheet.xPixels, mapSheet.yPixels) != gpx2pdf::SUCCESS)
+        return false;
+
+    std::vector<gpx2pdf::pixelWaypoint> pixelWaypoints;
+    if (converter.getPixelWaypoints(&pixelWaypoints) != gpx2pdf::SUCCESS)
+        return false;
+
+    for (unsigned int i = 0; i < pixelWaypoints.size(); i++) {
+        if (pixelWaypoints.at(i).x >= 0 && pixelWaypoints.at(i).x <= mapSheet.xPixels &&
+            pixelWaypoints.at(i).y >= 0 && pixelWaypoints.at(i).y <= mapSheet.yPixels)
+            return true;
+    }
+    return false;
+}
+
+std::string mapcatalog::getPdfFilePath(const sheet &mapSheet) {
+    QDir indexDir = QFileInfo(QString::fromStdString(this->indexFile)).absoluteDir();
+    return indexDir.absoluteFilePath(QString::fromStdString(mapSheet.pdfFile)).toStdString();
+}
+
+gpx2pdf::g2pErr mapcatalog::convert(std::string gpxFile, std::string outputDirectory) {
+    if (!this->spatialIndex)
+        return gpx2pdf::ERROR;
+
+    // Read the waypoints once to find which sheets they are on
+    gpx2pdf reader(gpxFile, "", "");
+    gpx2pdf::g2pErr result = reader.loadGpx();
+    if (result != gpx2pdf::SUCCESS)
+        return result;
+
+    // The waypoints are shared with all the conversions, so the GPX file is only read once
+    std::shared_ptr<const std::vector<gpx2pdf::waypoint>> sharedWaypoints = reader.getWaypoints();
+    const std::vector<gpx2pdf::waypoint> &waypoints = *sharedWaypoints;
+    CPLRectObj extent = {waypoints.at(0).lon, waypoints.at(0).lat, waypoints.at(0).lon, waypoints.at(0).lat};
+    for (unsigned int i = 1; i < waypoints.size(); i++) {
+        extent.minx = std::min(extent.minx, waypoints.at(i).lon);
+        extent.miny = std::min(extent.miny, waypoints.at(i).lat);
+        extent.maxx = std::max(extent.maxx, waypoints.at(i).lon);
+        extent.maxy = std::max(extent.maxy, waypoints.at(i).lat);
+    }
+
+    int candidateCount = 0;
+    void** candidates = CPLQuadTreeSearch(this->spatialIndex, &extent, &candidateCount);
+
+    // The extent can cover sheets that are between waypoints, so only keep sheets with a waypoint on them
+    std::vector<sheet*> matches;
+    for (int i = 0; i < candidateCount; i++) {
+        sheet* mapSheet = static_cast<sheet*>(candidates[i]);
+        if (this->hasWaypointOnSheet(*mapSheet, waypoints))
+            matches.push_back(mapSheet);
+    }
+    CPLFree(candidates);
+
+    std::cout << matches.size() << " map sheet(s) with waypoints found\n";
+    if (matches.size() < 1)
+        return gpx2pdf::EMPTY_DATA;
+
+    if (!QDir().mkpath(QString::fromStdString(outputDirectory))) {
+        std::cout << "Unable to create output directory: " << outputDirectory << "\n";
+        return gpx2pdf::FILE_ERROR;
+    }
+
+    gpx2pdf::initPdfLibrary();
+
+    // Convert all the sheets at the same time
+    // The geospatial data comes from the catalog, so the GeoPDFs don't need to be opened with GDAL again
+    // Each job writes its status to its own stream, which is printed once the job has finished
+    std::vector<QFuture<gpx2pdf::g2pErr>> jobs;
+    std::vector<std::shared_ptr<std::stringstream>> jobOutputs;
+    std::vector<std::string> jobNames;
+    std::set<QString> outputFiles;
+    QDir outputDir(QString::fromStdString(outputDirectory));
+    for (unsigned int i = 0; i < matches.size(); i++) {
+        const sheet &mapSheet = *matches.at(i);
+        unsigned int sheetIndex = static_cast<unsigned int>(matches.at(i) - this->sheets.data());
+
+        // output file keeps the directory structure of the maps relative to the index file, with the page number added
+        QStringList pathParts = QString::fromStdString(mapSheet.pdfFile).split('/');
+        pathParts.removeAll(QString());
+        for (int j = 0; j < pathParts.size(); j++) {
+            if (pathParts[j] == "..")
+                pathParts[j] = "_parent_";
+            pathParts[j].replace(':', '_');
+        }
+        QString fileName = pathParts.isEmpty() ? QString("map") : pathParts.takeLast();
+        fileName.chop(QFileInfo(fileName).suffix().size() + 1);
+        QString subDir = pathParts.join('/');
+
+        // names can still clash on case insensitive file systems, so add the sheet index when they do
+        QString outName = QString("%1_p%2.pdf").arg(fileName).arg(mapSheet.pageNumber);
+        QString outPath = outputDir.absoluteFilePath(subDir.isEmpty() ? outName : subDir + "/" + outName);
+        if (outputFiles.count(outPath.toLower())) {
+            outName = QString("%1_p%2_s%3.pdf").arg(fileName).arg(mapSheet.pageNumber).arg(sheetIndex);
+            outPath = outputDir.absoluteFilePath(subDir.isEmpty() ? outName : subDir + "/" + outName);
+        }
+        outputFiles.insert(outPath.toLower());
+
+        if (!QDir().mkpath(QFileInfo(outPath).absolutePath())) {
+            std::cout << "Unable to create output directory: " << QFileInfo(outPath).absolutePath().toStdString() << "\n";
+            continue;
+        }
+
+        std::string pdfFileIn = this->getPdfFilePath(mapSheet);
+        std::string pdfFileOut = outPath.toStdString();
+        std::string srsWkt = this->srsList.at(mapSheet.srsIndex);
+        bool lowMemory = this->lowMemory;
+        gpx2pdf::g2pAggregation aggregationMode = this->aggregationMode;
+        int aggregationThreshold = this->aggregationThreshold;
+        double aggregationCellSize = this->aggregationCellSize;
+        std::shared_ptr<std::stringstream> jobOutput = std::make_shared<std::stringstream>();
+
+        jobs.push_back(QtConcurrent::run([=]() {
+            gpx2pdf converter(gpxFile, pdfFileIn, pdfFileOut);
+            converter.setOutputStream(jobOutput.get());
+            converter.setPageNumber(mapSheet.pageNumber);
+            converter.setLowMemoryMode(lowMemory);
+            converter.setAggregationMode(aggregationMode);
+            converter.setAggregationThreshold(aggregationThreshold);
+            converter.setAggregationCellSize(aggregationCellSize);
+            converter.setWaypoints(sharedWaypoints);
+
+            gpx2pdf::g2pErr jobResult = converter.setGeospatialData(mapSheet.geoTransform, srsWkt, mapSheet.xPixels, mapSheet.yPixels);
+            if (jobResult == gpx2pdf::SUCCESS)
+                jobResult = converter.savePdf();
+            return jobResult;
+        }));
+        jobOutputs.push_back(jobOutput);
+        jobNames.push_back(mapSheet.pdfFile + " page " + std::to_string(mapSheet.pageNumber));
+    }
+
+    // savePdf() returns INVALID_ARGUMENT when none of the waypoints are on the page, that sheet is skipped rather than failed
+    int successCount = 0;
+    int skippedCount = 0;
+    for (unsigned int i = 0; i < jobs.size(); i++) {
+        gpx2pdf::g2pErr jobResult = jobs.at(i).result();
+        if (jobResult == gpx2pdf::SUCCESS)
+            successCount++;
+        else if (jobResult == gpx2pdf::INVALID_ARGUMENT)
+            skippedCount++;
+
+        std::string line;
+        while (std::getline(*jobOutputs.at(i), line))
+            std::cout << "[" << jobNames.at(i) << "] " << line << "\n";
+    }
+
+    std::cout << successCount << " of " << jobs.size() << " map sheet(s) written to: " << outputDirectory << "\n";
+    if (skippedCount > 0)
+        std::cout << skippedCount << " map sheet(s) skipped\n";
+    if (successCount < 1)
+        return (skippedCount == static_cast<int>(jobs.size())) ? gpx2pdf::EMPTY_DATA : gpx2pdf::ERROR;
+
+    return gpx2pdf::SUCCESS;
+}
@@ -0,0 +1,174 @@
+/**
+  @file    mapcatalog.h
+  @author  Ben <admin@laighside.com>
+  @version 1.0
+
+  @section DESCRIPTION
+  A catalog of GeoPDF map sheets, used to find every sheet that has waypoints from a GPX file on it.
+  The catalog is built once by scanning a directory and saved to an index file.
+  The status is outputed to std::cout as the data is processed
+ */
+
+#ifndef MAPCATALOG_H
+#define MAPCATALOG_H
+
+#include <string>
+#include <vector>
+
+#include <cpl_quad_tree.h>
+
+#include "gpx2pdf.h"
+
+class mapcatalog
+{
+public:
+
+    /**
+      Constructer for mapcatalog class.
+
+      @param indexFile is the catalog index file. It is written by build() and read by load().
+    */
+    mapcatalog(std::string indexFile);
+
+    /**
+      Destructor for mapcatalog class.
+    */
+    ~mapcatalog();
+
+    /**
+      Builds the catalog and saves it to the index file.
+
+      Every PDF file in the directory (and sub directories) is opened with GDAL, and the geospatial data for each page is stored.
+      Files that are not GeoPDFs are skipped.
+
+      @param mapDirectory is the directory that contains the GeoPDF files.
+      @return SUCCESS if at least one map sheet was found and the index file was written, and error code otherwise.
+    */
+    gpx2pdf::g2pErr build(std::string mapDirectory);
+
+    /**
+      Loads the catalog from the index file.
+
+      @return SUCCESS if the index file was read, and error code otherwise.
+    */
+    gpx2pdf::g2pErr load();
+
+    /**
+      Puts the waypoints on every map sheet in the catalog that has at least one of them on it.
+
+      The catalog must be loaded first. The GPX file is read once and the sheets are converted at the same time on a thread pool.
+      Each one is saved under the output directory with the same directory structure as the maps, and the page number added to the name.
+      The status of each sheet is printed when it has finished.
+
+      @param gpxFile is the GPX file with the waypoints to put on the maps.
+      @param outputDirectory is the directory to write the PDF files to, it is created if it doesn't exist.
+      Sheets that turn out to have no waypoints on the page are skipped, and don't count as a failure.
+
+      @return SUCCESS if at least one sheet was converted successfully, and error code otherwise.
+    */
+    gpx2pdf::g2pErr convert(std::string gpxFile, std::string outputDirectory);
+
+    /**
+      Builds a catalog without an object.
+
+      @param mapDirectory is the directory that contains the GeoPDF files.
+      @param indexFile is where the catalog index file is written to.
+      @return SUCCESS if the index file was written, and error code otherwise.
+    */
+    static gpx2pdf::g2pErr buildCatalog(std::string mapDirectory, std::string indexFile);
+
+    /**
+      Sets whether to use low memory mode when writing each PDF file, see gpx2pdf::setLowMemoryMode().
+
+      @param lowMemory is set to true to use low memory mode.
+    */
+    void setLowMemoryMode(bool lowMemory);
+
+    /**
+      Sets how to draw sheets with a lot of waypoints on them, see gpx2pdf::setAggregationMode().
+
+      @param aggregationMode is the aggregation mode.
+    */
+    void setAggregationMode(gpx2pdf::g2pAggregation aggregationMode);
+
+    /**
+      Sets the number of waypoints on a sheet above which the aggregation mode is used, see gpx2pdf::setAggregationThreshold().
+
+      @param aggregationThreshold is the maximum number of waypoints to draw individually.
+    */
+    void setAggregationThreshold(int aggregationThreshold);
+
+    /**
+      Sets the size of the grid cells that waypoints are grouped into, see gpx2pdf::setAggregationCellSize().
+
+      @param aggregationCellSize is the width and height of each cell, in PDF units (at least 1).
+    */
+    void setAggregationCellSize(double aggregationCellSize);
+
+private:
+    /**
+      An object to store the geospatial data of one page of a GeoPDF file.
+    */
+    struct sheet {
+        std::string pdfFile;           /*!< Path of the PDF file, relative to the index file */
+        int pageNumber;
+        int xPixels;
+        int yPixels;
+        double minLat;                 /*!< Area covered by the page (WGS84, decimal degrees) */
+        double minLon;
+        double maxLat;
+        double maxLon;
+        double geoTransform[6];
+        unsigned int srsIndex;         /*!< Index into srsList, most sheets share one of a few SRS */
+    };
+
+    /**
+      Reads the geospatial data of one page and adds it to the catalog.
+
+      @param pdfFile is the absolute path of the PDF file.
+      @param pageNumber is the page to read.
+      @param pageCount is a pointer to a variable where the number of pages will be placed (only when pageNumber is 1).
+      @return SUCCESS if the page was added, and error code otherwise.
+    */
+    gpx2pdf::g2pErr addSheet(std::string pdfFile, int pageNumber, int *pageCount);
+
+    /**
+      Writes the catalog to the index file.
+
+      @return SUCCESS if the file was written, and error code otherwise.
+    */
+    gpx2pdf::g2pErr save();
+
+    /**
+      Builds the spatial index over the areas covered by the sheets.
+    */
+    void buildSpatialIndex();
+
+    /**
+      Checks if at least one waypoint is on a sheet.
+
+      The waypoints are converted to pixels with the sheet's geotransform and SRS, so rotated and projected pages are handled.
+
+      @param mapSheet is the sheet to check.
+      @param waypoints are the waypoints (WGS84, decimal degrees).
+      @return true if a waypoint is on the page.
+    */
+    bool hasWaypointOnSheet(const sheet &mapSheet, const std::vector<gpx2pdf::waypoint> &waypoints);
+
+    /**
+      Gets the absolute path of a sheet's PDF file.
+    */
+    std::string getPdfFilePath(const sheet &mapSheet);
+
+    std::string indexFile;             /*!< Stores the index file path */
+    bool lowMemory;                    /*!< Passed on to gpx2pdf::setLowMemoryMode() */
+    gpx2pdf::g2pAggregation aggregationMode;  /*!< Passed on to gpx2pdf::setAggregationMode() */
+    int aggregationThreshold;                 /*!< Passed on to gpx2pdf::setAggregationThreshold() */
+    double aggregationCellSize;               /*!< Passed on to gpx2pdf::setAggregationCellSize() */
+
+    std::vector<sheet> sheets;         /*!< All the pages in the catalog */
+    std::vector<std::string> srsList;  /*!< Unique spatial reference systems used by the sheets, as WKT */
+    CPLQuadTree* spatialIndex;         /*!< Quad tree of pointers into sheets, by area covered */
+};
+
+#endif // MAPCATALOG_H
@@ -0,0 +1,558 @@
+/**
+  @file    mappreview.cpp
+  @author  Ben <admin@laighside.com>
+  @version 1.0
+
+  @section DESCRIPTION
+  A Qt widget that shows a preview of the GeoPDF map with the waypoints drawn over it.
+  The map is rasterized by GDAL into a pyramid of tiles, which are rendered on background
+  threads and cached on disk so the map only needs to be rendered once.
+ */
+
+#include "mappreview.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFontMetricsF>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QStandardPaths>
+#include <QWheelEvent>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <cpl_error.h>
+#include <gdal.h>
+#include <gdal_priv.h>
+
+const int MapPreview::tileSize;
+const int MapPreview::maxRenderJobs;
+const qint64 MapPreview::maxCacheBytes;
+
+MapPreview::MapPreview(QWidget *parent) :
+    QWidget(parent),
+    tileCache(256)
+{
+    this->xPixels = 0;
+    this->yPixels = 0;
+    this->levelCount = 0;
+    this->dpi = 150.0;
+    this->scale = 1.0;
+    this->fitted = true;
+    this->dragging = false;
+    this->maxNameLength = 10;
+    this->nameFontSize = 8.0;
+    this->renderShared = std::make_shared<renderState>();
+    this->renderShared->cancel = false;
+    this->renderShared->jobCount = 0;
+    this->renderShared->receiver = this;
+
+    this->setMinimumHeight(200);
+    this->setMouseTracking(false);
+}
+
+MapPreview::~MapPreview() {
+    this->stopRendering();
+}
+
+void MapPreview::setMap(const QString &pdfFile, int xPixels, int yPixels, double dpi) {
+    this->stopRendering();
+    this->tileCache.clear();
+    this->failedTiles.clear();
+    this->lastError.clear();
+
+    this->pdfFile = pdfFile;
+    this->xPixels = xPixels;
+    this->yPixels = yPixels;
+    if (dpi > 0)
+        this->dpi = dpi;
+    this->levelCount = 0;
+
+    if (this->pdfFile.isEmpty() || xPixels <= 0 || yPixels <= 0) {
+        this->update();
+        return;
+    }
+
+    // Keep adding levels until the whole page fits in a single tile
+    this->levelCount = 1;
+    while ((std::max(xPixels, yPixels) >> (this->levelCount - 1)) > tileSize)
+        this->levelCount++;
+
+    // The cache directory is unique to the file contents (as far as size and modified time can tell) and the render size
+    QFileInfo fileInfo(this->pdfFile);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(fileInfo.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(fileInfo.size()));
+    hash.addData(QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray::number(xPixels) + "x" + QByteArray::number(yPixels));
+    this->cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/tiles/" + QString::fromLatin1(hash.result().toHex());
+    QDir().mkpath(this->cacheDir);
+
+    // Marks the directory as used, for pruneCache()
+    QFile usedFile(this->cacheDir + "/last_used");
+    if (usedFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        usedFile.write(QByteArray::number(QDateTime::currentMSecsSinceEpoch()));
+        usedFile.close();
+    }
+    this->pruneCache();
+
+    this->fitToWidget();
+    this->update();
+}
+
+void MapPreview::setWaypoints(const std::vector<gpx2pdf::pixelWaypoint> &waypoints) {
+    this->waypoints = waypoints;
+    this->update();
+}
+
+void MapPreview::setMaxNameLength(int maxNameLength) {
+    this->maxNameLength = maxNameLength;
+    this->update();
+}
+
+void MapPreview::setNameFontSize(double nameFontSize) {
+    this->nameFontSize = nameFontSize;
+    this->update();
+}
+
+bool MapPreview::hasMap() {
+    return this->levelCount > 0;
+}
+
+void MapPreview::renderTiles(QString pdfFile, QString cacheDir, int xPixels, int yPixels, std::shared_ptr<renderState> state) {
+    GDALAllRegister();
+
+    // GDAL datasets can't be shared between threads, so each job opens its own when it gets its first tile
+    GDALDataset *pdfDataset = nullptr;
+    int bandCount = 3;
+    int bandMap[4] = {1, 2, 3, 4};
+
+    GDALRasterIOExtraArg extraArg;
+    INIT_RASTERIO_EXTRA_ARG(extraArg);
+    extraArg.eResampleAlg = GRIORA_Average;
+
+    while (true) {
+        tileRequest request;
+        QString key;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->cancel.load() || state->queue.empty()) {
+                state->jobCount--;
+                break;
+            }
+            request = state->queue.front();
+            state->queue.erase(state->queue.begin());
+            key = tileKey(request.level, request.tileX, request.tileY);
+            state->rendering.insert(key);
+        }
+
+        QString error;
+        bool fatal = false;
+
+        if (!pdfDataset) {
+            pdfDataset = static_cast<GDALDataset*>(GDALDataset::Open(pdfFile.toStdString().c_str(), GDAL_OF_RASTER | GDAL_OF_READONLY));
+            if (!pdfDataset) {
+                error = tr("Unable to open PDF file for the preview: %1").arg(pdfFile);
+                fatal = true;
+            } else if (pdfDataset->GetRasterXSize() != xPixels || pdfDataset->GetRasterYSize() != yPixels || pdfDataset->GetRasterCount() < 1) {
+                error = tr("PDF page size has changed since the preview was loaded, press Preview again");
+                fatal = true;
+                GDALClose(pdfDataset);
+                pdfDataset = nullptr;
+            } else {
+                // Read RGB(A) into an RGBA buffer, grey scale pages are read into all three colour channels
+                bandCount = pdfDataset->GetRasterCount() >= 4 ? 4 : 3;
+                if (pdfDataset->GetRasterCount() < 3)
+                    bandMap[1] = bandMap[2] = 1;
+            }
+        }
+
+        if (pdfDataset) {
+            int level = request.level;
+            int levelWidth = (xPixels + (1 << level) - 1) >> level;
+            int levelHeight = (yPixels + (1 << level) - 1) >> level;
+
+            // Size of the tile at this level, and the area it covers at level 0
+            int bufWidth = std::min(tileSize, levelWidth - request.tileX * tileSize);
+            int bufHeight = std::min(tileSize, levelHeight - request.tileY * tileSize);
+            int xOff = (request.tileX * tileSize) << level;
+            int yOff = (request.tileY * tileSize) << level;
+            int xSize = std::min(bufWidth << level, xPixels - xOff);
+            int ySize = std::min(bufHeight << level, yPixels - yOff);
+
+            QImage tile(bufWidth, bufHeight, QImage::Format_RGBA8888);
+            tile.fill(Qt::white);
+
+            QString fileName = tileFileName(cacheDir, level, request.tileX, request.tileY);
+            QString tempFileName = fileName + ".tmp";
+            if (pdfDataset->RasterIO(GF_Read, xOff, yOff, xSize, ySize, tile.bits(), bufWidth, bufHeight, GDT_Byte,
+                                     bandCount, bandMap, 4, tile.bytesPerLine(), 1, &extraArg) != CE_None) {
+                error = tr("Error rendering the preview: %1").arg(QString::fromUtf8(CPLGetLastErrorMsg()));
+            } else if (!tile.save(tempFileName, "PNG") || !QFile::rename(tempFileName, fileName)) {
+                // Written to a temporary file first so the GUI thread never reads a half written tile
+                QFile::remove(tempFileName);
+                error = tr("Unable to write preview tile to the cache: %1").arg(fileName);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->rendering.remove(key);
+
+            // If the file can't be opened then none of the queued tiles can be rendered either
+            QStringList failedKeys;
+            if (!error.isEmpty()) {
+                failedKeys.append(key);
+                if (fatal) {
+                    for (const tileRequest &queued : state->queue)
+                        failedKeys.append(tileKey(queued.level, queued.tileX, queued.tileY));
+                    state->queue.clear();
+                }
+            }
+
+            // The widget clears the receiver under this lock before it is destroyed, so it is safe to post to it here
+            if (state->receiver && !state->cancel.load()) {
+                if (error.isEmpty())
+                    QMetaObject::invokeMethod(state->receiver, "tileRendered", Qt::QueuedConnection);
+                else
+                    QMetaObject::invokeMethod(state->receiver, "tilesFailed", Qt::QueuedConnection, Q_ARG(QStringList, failedKeys), Q_ARG(QString, error));
+            }
+        }
+    }
+
+    if (pdfDataset)
+        GDALClose(pdfDataset);
+}
+
+QString MapPreview::tileFileName(const QString &cacheDir, int level, int tileX, int tileY) {
+    return cacheDir + QString("/%1_%2_%3.png").arg(level).arg(tileX).arg(tileY);
+}
+
+QString MapPreview::tileKey(int level, int tileX, int tileY) {
+    return QString("%1_%2_%3").arg(level).arg(tileX).arg(tileY);
+}
+
+QImage MapPreview::getTile(int level, int tileX, int tileY) {
+    QString key = tileKey(level, tileX, tileY);
+
+    QImage* cached = this->tileCache.object(key);
+    if (cached)
+        return *cached;
+
+    QString fileName = tileFileName(this->cacheDir, level, tileX, tileY);
+    if (QFile::exists(fileName)) {
+        QImage tile(fileName);
+        if (!tile.isNull()) {
+            this->tileCache.insert(key, new QImage(tile));
+            return tile;
+        }
+    }
+
+    return QImage();
+}
+
+void MapPreview::queueTiles(const std::vector<tileRequest> &tiles) {
+    std::shared_ptr<renderState> state = this->renderShared;
+    int newJobs = 0;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->queue.clear();
+        for (const tileRequest &tile : tiles) {
+            if (!state->rendering.contains(tileKey(tile.level, tile.tileX, tile.tileY)))
+                state->queue.push_back(tile);
+        }
+
+        newJobs = std::min(maxRenderJobs - state->jobCount, static_cast<int>(state->queue.size()));
+        if (newJobs > 0)
+            state->jobCount += newJobs;
+    }
+
+    QString pdfFile = this->pdfFile;
+    QString cacheDir = this->cacheDir;
+    int xPixels = this->xPixels;
+    int yPixels = this->yPixels;
+    for (int i = 0; i < newJobs; i++) {
+        QFuture<void> job = QtConcurrent::run([=]() {
+            renderTiles(pdfFile, cacheDir, xPixels, yPixels, state);
+        });
+        Q_UNUSED(job);
+    }
+}
+
+void MapPreview::tileRendered() {
+    this->update();
+}
+
+void MapPreview::tilesFailed(const QStringList &keys, const QString &message) {
+    // The tiles are requested again after the view changes, rather than straight away from the next paint
+    for (const QString &key : keys)
+        this->failedTiles.insert(key);
+
+    if (message != this->lastError) {
+        this->lastError = message;
+        emit renderFailed(message);
+    }
+
+    this->update();
+}
+
+void MapPreview::stopRendering() {
+    // The jobs finish the tile they are on and then stop, they keep the old state alive until they do
+    {
+        std::lock_guard<std::mutex> lock(this->renderShared->mutex);
+        this->renderShared->cancel.store(true);
+        this->renderShared->queue.clear();
+        this->renderShared->receiver = nullptr;
+    }
+
+    // Jobs started after this point get a new state
+    this->renderShared = std::make_shared<renderState>();
+    this->renderShared->cancel = false;
+    this->renderShared->jobCount = 0;
+    this->renderShared->receiver = this;
+}
+
+void MapPreview::pruneCache() {
+    QString tilesDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/tiles";
+
+    struct cacheEntry {
+        QString path;
+        QDateTime lastUsed;
+        qint64 size;
+    };
+    std::vector<cacheEntry> entries;
+    qint64 totalSize = 0;
+
+    for (const QFileInfo &dirInfo : QDir(tilesDir).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        cacheEntry entry;
+        entry.path = dirInfo.absoluteFilePath();
+        entry.size = 0;
+
+        QFileInfo usedInfo(entry.path + "/last_used");
+        entry.lastUsed = usedInfo.exists() ? usedInfo.lastModified() : dirInfo.lastModified();
+
+        QDirIterator files(entry.path, QDir::Files);
+        while (files.hasNext()) {
+            files.next();
+            entry.size += files.fileInfo().size();
+        }
+
+        totalSize += entry.size;
+        entries.push_back(entry);
+    }
+
+    if (totalSize <= maxCacheBytes)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const cacheEntry &a, const cacheEntry &b) {
+        return a.lastUsed < b.lastUsed;
+    });
+
+    QString currentDir = QFileInfo(this->cacheDir).absoluteFilePath();
+    for (const cacheEntry &entry : entries) {
+        if (totalSize <= maxCacheBytes)
+            break;
+        if (entry.path == currentDir)
+            continue;
+        if (QDir(entry.path).removeRecursively())
+            totalSize -= entry.size;
+    }
+}
+
+void MapPreview::fitToWidget() {
+    if (this->xPixels <= 0 || this->yPixels <= 0)
+        return;
+
+    this->scale = std::min(this->width() / static_cast<double>(this->xPixels), this->height() / static_cast<double>(this->yPixels));
+    this->offset = QPointF((this->width() - this->xPixels * this->scale) / 2, (this->height() - this->yPixels * this->scale) / 2);
+    this->fitted = true;
+}
+
+void MapPreview::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    painter.fillRect(this->rect(), Qt::gray);
+
+    if (!this->hasMap()) {
+        painter.drawText(this->rect(), Qt::AlignCenter, tr("No preview loaded"));
+        return;
+    }
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    // Use the smallest level that still has at least one level pixel per screen pixel
+    int level = 0;
+    if (this->scale < 1.0)
+        level = std::min(static_cast<int>(std::floor(std::log2(1.0 / this->scale))), this->levelCount - 1);
+    double levelScale = this->scale * (1 << level);
+
+    int levelWidth = (this->xPixels + (1 << level) - 1) >> level;
+    int levelHeight = (this->yPixels + (1 << level) - 1) >> level;
+    int tilesX = (levelWidth + tileSize - 1) / tileSize;
+    int tilesY = (levelHeight + tileSize - 1) / tileSize;
+
+    // Range of tiles that are visible in the widget
+    int firstX = std::max(0, static_cast<int>(std::floor(-this->offset.x() / levelScale / tileSize)));
+    int firstY = std::max(0, static_cast<int>(std::floor(-this->offset.y() / levelScale / tileSize)));
+    int lastX = std::min(tilesX - 1, static_cast<int>(std::floor((this->width() - this->offset.x()) / levelScale / tileSize)));
+    int lastY = std::min(tilesY - 1, static_cast<int>(std::floor((this->height() - this->offset.y()) / levelScale / tileSize)));
+
+    // Visible tiles that still need rendering
+    std::vector<tileRequest> missing;
+
+    for (int tileY = firstY; tileY <= lastY; tileY++) {
+        for (int tileX = firstX; tileX <= lastX; tileX++) {
+            QRectF target(this->offset.x() + tileX * tileSize * levelScale, this->offset.y() + tileY * tileSize * levelScale,
+                          tileSize * levelScale, tileSize * levelScale);
+
+            QImage tile = this->getTile(level, tileX, tileY);
+            if (!tile.isNull()) {
+                target.setSize(QSizeF(tile.width() * levelScale, tile.height() * levelScale));
+                painter.drawImage(target, tile);
+                continue;
+            }
+
+            if (!this->failedTiles.contains(tileKey(level, tileX, tileY))) {
+                tileRequest request = {level, tileX, tileY};
+                missing.push_back(request);
+            }
+
+            // While the tile is being rendered, stretch the matching part of a coarser tile that is already cached
+            for (int coarseLevel = level + 1; coarseLevel < this->levelCount; coarseLevel++) {
+                int shift = coarseLevel - level;
+                QImage* coarseTile = this->tileCache.object(tileKey(coarseLevel, tileX >> shift, tileY >> shift));
+                if (!coarseTile)
+                    continue;
+
+                double subSize = tileSize / static_cast<double>(1 << shift);
+                QRectF source(((tileX * tileSize) >> shift) - (tileX >> shift) * tileSize,
+                              ((tileY * tileSize) >> shift) - (tileY >> shift) * tileSize, subSize, subSize);
+                source = source.intersected(QRectF(coarseTile->rect()));
+                target.setSize(QSizeF(source.width() * (1 << shift) * levelScale, source.height() * (1 << shift) * levelScale));
+                painter.drawImage(target, *coarseTile, source);
+                break;
+            }
+        }
+    }
+
+    // Render the tiles nearest the centre of the view first, anything queued that is no longer visible is dropped
+    double centreX = (this->width() / 2.0 - this->offset.x()) / levelScale / tileSize - 0.5;
+    double centreY = (this->height() / 2.0 - this->offset.y()) / levelScale / tileSize - 0.5;
+    std::sort(missing.begin(), missing.end(), [=](const tileRequest &a, const tileRequest &b) {
+        return (a.tileX - centreX) * (a.tileX - centreX) + (a.tileY - centreY) * (a.tileY - centreY) <
+               (b.tileX - centreX) * (b.tileX - centreX) + (b.tileY - centreY) * (b.tileY - centreY);
+    });
+    this->queueTiles(missing);
+
+    this->drawWaypoints(painter);
+}
+
+void MapPreview::drawWaypoints(QPainter &painter) {
+    // Waypoint symbols are sized in PDF points, there are 72 points per inch
+    double pointScale = this->scale * this->dpi / 72.0;
+    double fontPixels = this->nameFontSize * pointScale;
+
+    QFont font("Helvetica");
+    font.setPointSizeF(std::max(fontPixels, 1.0) * 72.0 / this->logicalDpiY());
+    QFontMetricsF fontMetrics(font, this);
+    painter.setFont(font);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QPen(Qt::black, pointScale));
+
+    QRectF visible = QRectF(this->rect()).adjusted(-200, -200, 200, 200);
+    for (unsigned int i = 0; i < this->waypoints.size(); i++) {
+        // savePdf() only draws waypoints that are on the page
+        if (this->waypoints.at(i).x < 0 || this->waypoints.at(i).x > this->xPixels || this->waypoints.at(i).y < 0 || this->waypoints.at(i).y > this->yPixels)
+            continue;
+
+        QPointF pos(this->offset.x() + this->waypoints.at(i).x * this->scale, this->offset.y() + this->waypoints.at(i).y * this->scale);
+        if (!visible.contains(pos))
+            continue;
+
+        QString name = QString::fromStdString(this->waypoints.at(i).name);
+        if (this->maxNameLength >= 0)
+            name = name.left(this->maxNameLength);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+        double textWidth = fontMetrics.horizontalAdvance(name);
+#else
+        double textWidth = fontMetrics.width(name);
+#endif
+
+        // draw yellow rectangle
+        QRectF nameRect(pos.x() - textWidth / 2 - 2 * pointScale, pos.y() - (this->nameFontSize + 9) * pointScale,
+                        textWidth + 4 * pointScale, (this->nameFontSize + 3) * pointScale);
+        painter.setBrush(QColor(255, 255, 0));
+        painter.drawRect(nameRect);
+
+        // draw line below rectangle
+        painter.drawLine(pos, QPointF(pos.x(), pos.y() - 6 * pointScale));
+
+        // draw circle on waypoint
+        painter.setBrush(Qt::white);
+        painter.drawEllipse(pos, 3 * pointScale, 3 * pointScale);
+
+        // draw cross in middle of the circle
+        painter.drawLine(QPointF(pos.x(), pos.y() - 2 * pointScale), QPointF(pos.x(), pos.y() + 2 * pointScale));
+        painter.drawLine(QPointF(pos.x() - 2 * pointScale, pos.y()), QPointF(pos.x() + 2 * pointScale, pos.y()));
+
+        // draw the name within the rectangle
+        if (fontPixels >= 1.0)
+            painter.drawText(nameRect, Qt::AlignCenter, name);
+    }
+}
+
+void MapPreview::resizeEvent(QResizeEvent *) {
+    // Keep the user's zoom and pan, unless they haven't changed it since the page was fitted
+    if (!this->hasMap() || this->fitted)
+        this->fitToWidget();
+}
+
+void MapPreview::wheelEvent(QWheelEvent *event) {
+    if (!this->hasMap())
+        return;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    QPointF pos = event->position();
+#else
+    QPointF pos = event->posF();
+#endif
+
+    // zoom around the mouse position, limited to between half the fitted size and 4 screen pixels per page pixel
+    double minScale = 0.5 * std::min(this->width() / static_cast<double>(this->xPixels), this->height() / static_cast<double>(this->yPixels));
+    double newScale = std::max(minScale, std::min(4.0, this->scale * std::pow(1.0015, event->angleDelta().y())));
+    this->offset = pos - (pos - this->offset) * (newScale / this->scale);
+    this->scale = newScale;
+    this->fitted = false;
+    this->failedTiles.clear();
+    this->lastError.clear();
+
+    this->update();
+}
+
+void MapPreview::mousePressEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton) {
+        this->dragging = true;
+        this->lastMousePos = event->pos();
+        this->failedTiles.clear();
+        this->lastError.clear();
+    }
+}
+
+void MapPreview::mouseMoveEvent(QMouseEvent *event) {
+    if (this->dragging) {
+        this->offset += event->pos() - this->lastMousePos;
+        this->lastMousePos = event->pos();
+        this->fitted = false;
+        this->update();
+    }
+}
+
+void MapPreview::mouseReleaseEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton)
+        this->dragging = false;
+}
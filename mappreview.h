@@ -0,0 +1,214 @@
+/**
+  @file    mappreview.h
+  @author  Ben <admin@laighside.com>
+  @version 1.0
+
+  @section DESCRIPTION
+  A Qt widget that shows a preview of the GeoPDF map with the waypoints drawn over it.
+  The map is rasterized by GDAL into a pyramid of tiles, which are rendered on background
+  threads and cached on disk so the map only needs to be rendered once.
+ */
+
+#ifndef MAPPREVIEW_H
+#define MAPPREVIEW_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <QCache>
+#include <QImage>
+#include <QObject>
+#include <QPoint>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QWidget>
+
+#include "gpx2pdf.h"
+
+class MapPreview : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit MapPreview(QWidget *parent = nullptr);
+    ~MapPreview();
+
+    /**
+      Sets the map to show in the preview.
+
+      Any tiles already in the disk cache for this file are reused, the rest are rendered when they are first needed.
+
+      @param pdfFile is the GeoPDF file that contains the map.
+      @param xPixels is the width of the page in pixels, as returned by gpx2pdf::getXPixels().
+      @param yPixels is the height of the page in pixels, as returned by gpx2pdf::getYPixels().
+      @param dpi is the resolution the page was rendered at, as returned by gpx2pdf::getDpi(). Used to size the waypoint symbols.
+    */
+    void setMap(const QString &pdfFile, int xPixels, int yPixels, double dpi);
+
+    /**
+      Sets the waypoints to draw over the map.
+
+      @param waypoints are the waypoints in pixel coordinates, as returned by gpx2pdf::getPixelWaypoints().
+             The names should not be truncated, setMaxNameLength() is applied when drawing.
+    */
+    void setWaypoints(const std::vector<gpx2pdf::pixelWaypoint> &waypoints);
+
+    /**
+      Sets the maximum length for the names drawn on the map.
+
+      @param maxNameLength is the maximum name length (set to -1 for no maximum).
+    */
+    void setMaxNameLength(int maxNameLength);
+
+    /**
+      Sets the font size for drawing waypoint names on the map.
+
+      @param nameFontSize is the font size, in PDF points.
+    */
+    void setNameFontSize(double nameFontSize);
+
+    /**
+      Checks if a map has been loaded with setMap().
+
+      @return true if there is a map to show.
+    */
+    bool hasMap();
+
+signals:
+    /**
+      Emitted when part of the map could not be rendered.
+
+      @param message describes the error.
+    */
+    void renderFailed(const QString &message);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+
+private slots:
+    // called on the GUI thread when a background render job has written a tile
+    void tileRendered();
+
+    // called on the GUI thread when a background render job could not render some tiles
+    void tilesFailed(const QStringList &keys, const QString &message);
+
+private:
+    /**
+      A tile in the pyramid.
+    */
+    struct tileRequest {
+        int level;
+        int tileX;
+        int tileY;
+    };
+
+    /**
+      State shared between the widget and the background render jobs.
+    */
+    struct renderState {
+        std::atomic<bool> cancel;      /*!< Set to true when the widget no longer needs any more tiles */
+        std::mutex mutex;              /*!< Protects everything below */
+        std::vector<tileRequest> queue;  /*!< Visible tiles waiting to be rendered, nearest the centre of the view first */
+        QSet<QString> rendering;       /*!< Keys of the tiles the jobs are rendering now */
+        int jobCount;                  /*!< Number of render jobs that are running */
+        QObject *receiver;             /*!< The widget, set to nullptr when it stops listening */
+    };
+
+    /**
+      Renders tiles from the shared queue to the disk cache until the queue is empty or the render is cancelled.
+
+      This runs on a background thread, so it opens its own GDAL dataset and only talks to the widget with queued calls.
+      The widget is told after each tile so it can repaint.
+
+      @param pdfFile is the GeoPDF file to render.
+      @param cacheDir is the directory to write the tile images to.
+      @param xPixels is the width of the page at level 0.
+      @param yPixels is the height of the page at level 0.
+      @param state is shared with the widget, and holds the queue of tiles to render.
+    */
+    static void renderTiles(QString pdfFile, QString cacheDir, int xPixels, int yPixels, std::shared_ptr<renderState> state);
+
+    /**
+      Gets the file name of a tile in the disk cache.
+    */
+    static QString tileFileName(const QString &cacheDir, int level, int tileX, int tileY);
+
+    /**
+      Gets the key of a tile, used for the memory cache and the render queue.
+    */
+    static QString tileKey(int level, int tileX, int tileY);
+
+    /**
+      Gets a tile image, from memory if possible, otherwise from the disk cache.
+
+      @return the tile, or a null image if it has not been rendered yet.
+    */
+    QImage getTile(int level, int tileX, int tileY);
+
+    /**
+      Replaces the render queue with the given tiles and starts more render jobs if needed.
+
+      Tiles that were queued before but are not in the list are dropped, tiles that are already being rendered are skipped.
+
+      @param tiles are the missing tiles in the view, in the order to render them.
+    */
+    void queueTiles(const std::vector<tileRequest> &tiles);
+
+    /**
+      Stops the background render jobs from starting any more tiles, without waiting for them.
+    */
+    void stopRendering();
+
+    /**
+      Deletes the least recently used tile directories until the disk cache is under maxCacheBytes.
+
+      The directory for the current map is never deleted.
+    */
+    void pruneCache();
+
+    /**
+      Sets the scale and offset so that the whole page fits in the widget.
+    */
+    void fitToWidget();
+
+    /**
+      Draws the waypoints over the map using the same symbols as gpx2pdf::savePdf().
+    */
+    void drawWaypoints(QPainter &painter);
+
+    static const int tileSize = 256;   /*!< Width and height of each tile in pixels */
+    static const int maxRenderJobs = 2;  /*!< Number of tiles rendered at the same time */
+    static const qint64 maxCacheBytes = 512 * 1024 * 1024;  /*!< Size of the disk cache, over all maps */
+
+    QString pdfFile;                   /*!< The GeoPDF file being previewed */
+    QString cacheDir;                  /*!< Directory where tiles for this file are stored */
+    int xPixels;                       /*!< Width of the page in pixels at level 0 */
+    int yPixels;                       /*!< Height of the page in pixels at level 0 */
+    int levelCount;                    /*!< Number of levels in the tile pyramid */
+    double dpi;                        /*!< Resolution of the page at level 0, in pixels per inch */
+
+    double scale;                      /*!< Screen pixels per level 0 pixel */
+    QPointF offset;                    /*!< Screen position of the top left corner of the page */
+    bool fitted;                       /*!< True until the user zooms or pans, the page is refitted when the widget is resized */
+    QPoint lastMousePos;               /*!< Used for panning with the mouse */
+    bool dragging;
+
+    std::vector<gpx2pdf::pixelWaypoint> waypoints;
+    int maxNameLength;
+    double nameFontSize;
+
+    QCache<QString, QImage> tileCache;                /*!< Tiles that have been loaded from disk */
+    QSet<QString> failedTiles;                         /*!< Tiles that failed to render, retried when the view changes */
+    QString lastError;                                 /*!< Last error reported, so the same error is only reported once per view */
+    std::shared_ptr<renderState> renderShared;         /*!< Shared with the render jobs so they can be stopped and steered */
+};
+
+#endif // MAPPREVIEW_H